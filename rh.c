@@ -36,7 +36,9 @@
 #include <glob.h>
 #include <errno.h>
 #include <pwd.h>
+#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <langinfo.h>
 
 #include "rh.h"
@@ -86,9 +88,24 @@ static void help_message(void)
 	printf("  -m #         - Override the default minimum depth (0)\n");
 	printf("  -M #         - Override the default maximum depth (system limit)\n");
 	printf("  -D           - Depth-first searching (contents before directory)\n");
+	printf("  -W           - Breadth-first searching (shallowest entries first)\n");
 	printf("  -1           - Single filesystem (don't cross filesystem boundaries)\n");
+	printf("  -K types     - Don't search filesystems of these types (e.g., proc,nfs)\n");
+	printf("  -A i/N       - Only search shard i of N (to split a search across processes)\n");
+	printf("  -G names     - Skip what ignore files say (e.g., .gitignore,.ignore)\n");
 	printf("  -y           - Follow symlinks on the cmdline and in reference files\n");
 	printf("  -Y           - Follow symlinks encountered while searching as well\n");
+	printf("  -YY          - Same as -Y but only search each directory once\n");
+	printf("  -P #         - Search with # threads (output order varies)\n");
+	printf("  -J #         - Search # search paths at once (output order varies)\n");
+	printf("  -O           - Search in inode order (-OO stat in inode order only)\n");
+	printf("  -Z fname     - Write (or update) an index of the search to a file\n");
+	printf("  -z fname     - Search an index (written by -Z) instead of the filesystem\n");
+	printf("  -@ fname     - Test the paths listed in a file (- for stdin) without searching\n");
+	printf("  -w           - Then watch for changes and search/test what changed\n");
+	printf("  -C fname     - Only report changes since the last snapshot (in a file)\n");
+	printf("  -k fname     - Periodically checkpoint the search position to a file\n");
+	printf("  -R           - Resume the search from the -k checkpoint (if any)\n");
 	printf("\n");
 	printf("alternative action options:\n");
 	printf("  -x 'cmd %%s'  - Execute a shell command for each match (racy)\n");
@@ -137,7 +154,7 @@ static void help_message(void)
 	printf("\n");
 	printf("debug option:\n");
 	printf(" '-?' spec     - Output debug messages: spec can include any of:\n");
-	printf("                   cmdline, parser, traversal, exec, all, extra\n");
+	printf("                   cmdline, parser, optimizer, traversal, exec, all, extra\n");
 
 	printf("\nrh (rawhide) finds files using pretty C expressions.\n");
 	printf("See the rh(1) and rawhide.conf(5) manual entries for more information.\n");
@@ -441,6 +458,33 @@ static void magic_cleanup(void)
 
 /*
 
+static int visit_needs(void);
+
+Return what the visit function needs to know about matching candidates
+(NEED_* bits), so that rawhide_stat_visit() can fetch anything extra
+that the search criteria didn't need.
+
+*/
+
+static int visit_needs(void)
+{
+	if (attr.visitf == visitf_default)
+		return (attr.all_indicators) ? NEED_MODE : (attr.dir_indicator || attr.most_indicators) ? NEED_TYPE : NEED_PATH;
+
+	if (attr.visitf == visitf_execute || attr.visitf == visitf_execute_local)
+		return NEED_PATH;
+
+	if (attr.visitf == visitf_unlink)
+		return NEED_TYPE;
+
+	if (attr.visitf == visitf_long)
+		return NEED_STAT | ((attr.btime_column || attr.verbose) ? NEED_BTIME : 0);
+
+	return NEED_STAT;
+}
+
+/*
+
 int main(int argc, char *argv[]);
 
 Parse the command line:
@@ -468,7 +512,7 @@ Find matching files:
 
 Find matching files in directories specified by the
 remaining arguments (or in the current directory).
-The -rmMD1yY options alter traversal behaviour.
+The -rmMD1yYP options alter traversal behaviour.
 By default, matching entry names are output.
 The -l option and other options include more details.
 There are many options to affect the formatting.
@@ -487,12 +531,12 @@ and must be supplied three times in order to take effect.
 
 int main(int argc, char *argv[])
 {
-	char *opt_e, *initfile, *initdir, *initpattern, *endptr, **opt_f_list;
-	int opt_f, opt_h, opt_V, opt_l, opt_r, opt_N, opt_n, opt_U;
+	char *opt_e, *opt_Z, *opt_z, *opt_C, *opt_k, *opt_G, *opt_list, *initfile, *initdir, *initpattern, *endptr, **opt_f_list, **paths;
+	int opt_f, opt_h, opt_V, opt_l, opt_r, opt_N, opt_n, opt_U, opt_w, opt_R;
 	llong opt_m, opt_M, optarg_int, opt_e_expr = 0;
 	llong max_pathlen, pathbufsize;
 	struct stat statbuf[1];
-	int o, i, expr_index = 0, any = 0, stdin_read = 0;
+	int o, i, expr_index = 0, npaths = 0, ngiven, stdin_read = 0, opt_index;
 	uid_t uid;
 	gid_t gid;
 
@@ -523,8 +567,21 @@ int main(int argc, char *argv[])
 	opt_m = -1;                 /* -m (min depth) */
 	opt_M = -1;                 /* -M (max depth) */
 	attr.depth_first = 0;       /* -D (depth-first) */
+	attr.breadth_first = 0;     /* -W (breadth-first) */
 	attr.single_filesystem = 0; /* -1 (single filesystem) */
 	attr.follow_symlinks = 0;   /* -y -Y (follow symlinks: 1=supplied 2=encountered) */
+	attr.skip_revisits = 0;     /* -YY (don't search directories again via symlinks) */
+	attr.parallel = 1;          /* -P (number of threads) */
+	attr.path_threads = 1;      /* -J (number of search paths to search at once) */
+	attr.inode_order = 0;       /* -O (inode order: 1=search 2=stat) */
+	opt_Z = NULL;               /* -Z fname (write an index) */
+	opt_z = NULL;               /* -z fname (search an index) */
+	opt_C = NULL;               /* -C fname (write a snapshot, and only report changes since the last one) */
+	opt_w = 0;                  /* -w (watch for changes) */
+	opt_k = NULL;               /* -k fname (checkpoint the search position) */
+	opt_R = 0;                  /* -R (resume from the checkpoint) */
+	opt_G = NULL;               /* -G names (ignore files) */
+	opt_list = NULL;            /* -@ fname (search a list of paths) */
 
 	attr.command = NULL;        /* -x/-X cmd (execute cmd) */
 	attr.local = 0;             /* cmd executed locally (-X) */
@@ -579,8 +636,18 @@ int main(int argc, char *argv[])
 	attr.fea_solaris_no_sunwattr = env_flag("RAWHIDE_SOLARIS_EA_NO_SUNWATTR");
 	attr.fea_solaris_no_statinfo = env_flag("RAWHIDE_SOLARIS_EA_NO_STATINFO");
 	attr.fea_size = env_int("RAWHIDE_EA_SIZE", 1, -1, 0);
+	attr.getdents_bufsize = env_int("RAWHIDE_GETDENTS_BUFSIZE", 4096, 64 * 1024 * 1024, 256 * 1024);
+	attr.io_uring = env_int("RAWHIDE_IO_URING", 0, 4096, 0);
+	attr.prefetch = env_int("RAWHIDE_PREFETCH", 0, 256, 0);
+	attr.prefetch_depth = env_int("RAWHIDE_PREFETCH_DEPTH", 1, 64, 1);
+	attr.shard_depth = env_int("RAWHIDE_SHARD_DEPTH", 1, 1024, 1);
+	attr.inline_size = env_int("RAWHIDE_INLINE_SIZE", 0, 1024, INLINE_SIZE);
+	attr.optimize = !env_flag("RAWHIDE_NO_OPTIMIZER");
+	attr.bfs_memory = env_int("RAWHIDE_BFS_MEMORY", 0, -1, 64 * 1024 * 1024);
 	attr.implicit_expr_heuristic = env_flag("RAWHIDE_ALLOW_IMPLICIT_EXPR_HEURISTIC");
 	attr.user_shell = getenv("RAWHIDE_USER_SHELL");
+	if ((attr.skip_fstypes = getenv("RAWHIDE_SKIP_FSTYPES")) && !*attr.skip_fstypes)
+		attr.skip_fstypes = NULL;
 	attr.user_shell_like_csh = env_flag("RAWHIDE_USER_SHELL_LIKE_CSH");
 	attr.internal_fnmatch = env_flag("RAWHIDE_INTERNAL_GLOB");
 	attr.fnmatch = (attr.internal_fnmatch) ? rhfnmatch : fnmatch;
@@ -611,7 +678,7 @@ int main(int argc, char *argv[])
 	if (argc >= 2 && !strcmp(argv[1], "--version"))
 		version_message();
 
-	while ((o = getopt(argc, argv, ":hVNnf:e:rm:M:D1yYx:X:UldiBsSgoaucv0L:jQEbqptFHIT#?:")) != -1)
+	while ((o = getopt(argc, argv, ":hVNnf:e:rm:M:D1K:yYP:x:X:UldiBsSgoaucv0L:jQEbqptFHIT#?:OWJ:Z:z:wC:k:RA:G:@:")) != -1)
 	{
 		switch (o)
 		{
@@ -718,6 +785,13 @@ int main(int argc, char *argv[])
 				break;
 			}
 
+			case 'W':
+			{
+				attr.breadth_first = 1;
+
+				break;
+			}
+
 			case '1':
 			{
 				attr.single_filesystem = 1;
@@ -725,6 +799,16 @@ int main(int argc, char *argv[])
 				break;
 			}
 
+			case 'K':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -K option argument (see %s -h for help)", prog_name);
+
+				attr.skip_fstypes = optarg;
+
+				break;
+			}
+
 			case 'y':
 			{
 				attr.follow_symlinks = 1;
@@ -734,11 +818,148 @@ int main(int argc, char *argv[])
 
 			case 'Y':
 			{
+				if (attr.follow_symlinks == 2)
+					attr.skip_revisits = 1;
+
 				attr.follow_symlinks = 2;
 
 				break;
 			}
 
+			case 'P':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -P option argument (see %s -h for help)", prog_name);
+
+				errno = 0;
+				optarg_int = strtoll(optarg, &endptr, 10);
+
+				if ((endptr && *endptr) || optarg_int < 1 || optarg_int > 1024 || errno == ERANGE)
+					fatal("invalid -P option argument: %s (must be from 1 to 1024)", ok(optarg));
+
+				attr.parallel = (int)optarg_int;
+
+				break;
+			}
+
+			case 'J':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -J option argument (see %s -h for help)", prog_name);
+
+				errno = 0;
+				optarg_int = strtoll(optarg, &endptr, 10);
+
+				if ((endptr && *endptr) || optarg_int < 1 || optarg_int > 1024 || errno == ERANGE)
+					fatal("invalid -J option argument: %s (must be from 1 to 1024)", ok(optarg));
+
+				attr.path_threads = (int)optarg_int;
+
+				break;
+			}
+
+			case 'A':
+			{
+				llong shard, shards;
+
+				if (!optarg || !*optarg)
+					fatal("missing -A option argument (see %s -h for help)", prog_name);
+
+				errno = 0;
+				shard = strtoll(optarg, &endptr, 10);
+				shards = (endptr != optarg && *endptr == '/') ? strtoll(endptr + 1, &endptr, 10) : 0;
+
+				if (*endptr || shards < 1 || shards > 1000000 || shard < 1 || shard > shards || errno == ERANGE)
+					fatal("invalid -A option argument: %s (must be i/N, with i from 1 to N)", ok(optarg));
+
+				attr.shard = (int)shard;
+				attr.shards = (int)shards;
+
+				break;
+			}
+
+			case 'G':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -G option argument (see %s -h for help)", prog_name);
+
+				opt_G = optarg;
+
+				break;
+			}
+
+			case 'Z':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -Z option argument (see %s -h for help)", prog_name);
+
+				opt_Z = optarg;
+
+				break;
+			}
+
+			case 'z':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -z option argument (see %s -h for help)", prog_name);
+
+				opt_z = optarg;
+
+				break;
+			}
+
+			case '@':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -@ option argument (see %s -h for help)", prog_name);
+
+				opt_list = optarg;
+
+				break;
+			}
+
+			case 'C':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -C option argument (see %s -h for help)", prog_name);
+
+				opt_C = optarg;
+
+				break;
+			}
+
+			case 'w':
+			{
+				opt_w = 1;
+
+				break;
+			}
+
+			case 'k':
+			{
+				if (!optarg || !*optarg)
+					fatal("missing -k option argument (see %s -h for help)", prog_name);
+
+				opt_k = optarg;
+
+				break;
+			}
+
+			case 'R':
+			{
+				opt_R = 1;
+
+				break;
+			}
+
+			case 'O':
+			{
+				if (attr.inode_order < 2)
+					++attr.inode_order;
+
+				break;
+			}
+
 			case 'x':
 			case 'X':
 			{
@@ -987,6 +1208,9 @@ int main(int argc, char *argv[])
 				if (strstr(optarg, "all") || strstr(optarg, "parser"))
 					attr.debug_flags |= DEBUG_PARSER;
 
+				if (strstr(optarg, "all") || strstr(optarg, "optimizer"))
+					attr.debug_flags |= DEBUG_OPTIMIZER;
+
 				if (strstr(optarg, "all") || strstr(optarg, "traversal"))
 					attr.debug_flags |= DEBUG_TRAVERSAL;
 
@@ -997,7 +1221,7 @@ int main(int argc, char *argv[])
 					attr.debug_flags |= DEBUG_EXTRA;
 
 				if (!attr.debug_flags)
-					fatal("invalid -? option argument: %s (needs: cmdline parser traversal exec all extra)", ok(optarg));
+					fatal("invalid -? option argument: %s (needs: cmdline parser optimizer traversal exec all extra)", ok(optarg));
 
 				debug(("attr.debug_flags = 0x%x", attr.debug_flags));
 				#endif
@@ -1072,6 +1296,98 @@ int main(int argc, char *argv[])
 	if (opt_U && !attr.unlink)
 		fatal("-U option only works if supplied three times");
 
+	if (attr.breadth_first && attr.unlink)
+		fatal("-W and -U options are mutually exclusive");
+
+	if (attr.breadth_first && attr.depth_first)
+		fatal("-D and -W options are mutually exclusive");
+
+	if (attr.breadth_first && attr.parallel > 1)
+		fatal("-P and -W options are mutually exclusive");
+
+	if (attr.path_threads > 1 && attr.parallel > 1)
+		fatal("-J and -P options are mutually exclusive");
+
+	if (opt_Z && opt_z)
+		fatal("-Z and -z options are mutually exclusive");
+
+	if (opt_C && (opt_Z || opt_z))
+		fatal("-C and -%c options are mutually exclusive", (opt_Z) ? 'Z' : 'z');
+
+	opt_index = (opt_Z) ? 'Z' : (opt_z) ? 'z' : (opt_C) ? 'C' : 0;
+
+	if (opt_index && attr.parallel > 1)
+		fatal("-%c and -P options are mutually exclusive", opt_index);
+
+	if (opt_index && attr.path_threads > 1)
+		fatal("-%c and -J options are mutually exclusive", opt_index);
+
+	if (opt_index && attr.breadth_first)
+		fatal("-%c and -W options are mutually exclusive", opt_index);
+
+	if (opt_w && (opt_Z || opt_z))
+		fatal("-w and -%c options are mutually exclusive", (opt_Z) ? 'Z' : 'z');
+
+	if (opt_w && attr.parallel > 1)
+		fatal("-w and -P options are mutually exclusive");
+
+	if (opt_w && attr.path_threads > 1)
+		fatal("-w and -J options are mutually exclusive");
+
+	if (opt_w && attr.breadth_first)
+		fatal("-w and -W options are mutually exclusive");
+
+	if (opt_G && attr.parallel > 1)
+		fatal("-G and -P options are mutually exclusive");
+
+	if (opt_G && attr.breadth_first)
+		fatal("-G and -W options are mutually exclusive");
+
+	if (opt_G && opt_z)
+		fatal("-G and -z options are mutually exclusive");
+
+	if (opt_list && opt_index)
+		fatal("-@ and -%c options are mutually exclusive", opt_index);
+
+	if (opt_list && attr.parallel > 1)
+		fatal("-@ and -P options are mutually exclusive");
+
+	if (opt_list && attr.path_threads > 1)
+		fatal("-@ and -J options are mutually exclusive");
+
+	if (opt_list && attr.breadth_first)
+		fatal("-@ and -W options are mutually exclusive");
+
+	if (opt_list && opt_w)
+		fatal("-@ and -w options are mutually exclusive");
+
+	if (opt_list && opt_k)
+		fatal("-@ and -k options are mutually exclusive");
+
+	if (opt_list && opt_G)
+		fatal("-@ and -G options are mutually exclusive");
+
+	if (opt_list && attr.shards)
+		fatal("-@ and -A options are mutually exclusive");
+
+	if (opt_R && !opt_k)
+		fatal("-R option only works with the -k option");
+
+	if (opt_k && opt_index)
+		fatal("-k and -%c options are mutually exclusive", opt_index);
+
+	if (opt_k && attr.parallel > 1)
+		fatal("-k and -P options are mutually exclusive");
+
+	if (opt_k && attr.path_threads > 1)
+		fatal("-k and -J options are mutually exclusive");
+
+	if (opt_k && attr.breadth_first)
+		fatal("-k and -W options are mutually exclusive");
+
+	if (opt_k && attr.inode_order)
+		fatal("-k and -O options are mutually exclusive");
+
 	if (opt_l)
 		attr.visitf = visitf_long;
 
@@ -1180,6 +1496,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (opt_list && !strcmp(opt_list, "-") && stdin_read)
+		fatal("invalid -@ option argument: - (stdin can only be read once)");
+
 	/* Clean up */
 
 	if (opt_f_list)
@@ -1315,13 +1634,97 @@ int main(int argc, char *argv[])
 		load_program_str("1");
 	}
 
+	/* Optimize the program (before the symbols are deallocated, for debug messages) */
+
+	if (attr.optimize)
+		rawhide_optimize();
+
 	/* Deallocate symbols */
 
 	rawhide_finish();
 
+	/* Prepare the program for the interpreter */
+
+	rawhide_compile(env_flag("RAWHIDE_TEST_REFERENCE_ENGINE"));
+
+	/* Determine which stat(2) fields the search criteria and visit function need */
+
+	attr.needs = rawhide_needs();
+	attr.visit_needs = visit_needs();
+	debug(("needs = 0x%04x visit_needs = 0x%04x", attr.needs, attr.visit_needs));
+
+	/* Determine whether or not path patterns can be used to prune directories that can't contain any matches */
+
+	attr.path_pruning = !env_flag("RAWHIDE_NO_PATH_PRUNING") && rawhide_path_pruning();
+	debug(("path_pruning = %d", attr.path_pruning));
+
+	/* An index (or snapshot) needs the stat(2) information of everything searched */
+
+	if (opt_Z || opt_C)
+	{
+		attr.needs = NEED_STAT;
+		attr.path_pruning = 0;
+	}
+
+	/* Collect the search paths (or the current working directory) */
+
+	paths = malloc_or_fatalsys((argc - optind + 1) * sizeof(char *));
+
+	for (i = optind; i < argc; ++i)
+		if (i != expr_index) /* Skip implicit expression */
+			paths[npaths++] = argv[i];
+
+	if (!(ngiven = npaths))
+		paths[npaths++] = ".";
+
+	if (opt_list && ngiven)
+		fatal("-@ option can't be used with search paths");
+
 	/* Initialize depth limits in the global attr runtime state */
 
 	attr.depth_limit = sysconf(_SC_OPEN_MAX) - 5; /* stdin, stdout, stderr, dot_fd/dirsize/attropen+1 */
+
+	/* With -J, the threads share the open file limit (but each needs a few) */
+
+	if (attr.path_threads > npaths)
+		attr.path_threads = npaths;
+
+	if (attr.path_threads > 1 && attr.depth_limit / attr.path_threads < 16)
+		attr.path_threads = (attr.depth_limit / 16 > 1) ? attr.depth_limit / 16 : 1;
+
+	attr.depth_limit /= attr.path_threads;
+	attr.fd_window = env_int("RAWHIDE_FD_WINDOW", 0, attr.depth_limit, (attr.depth_limit < FD_WINDOW) ? attr.depth_limit : FD_WINDOW);
+
+	/* Only sequential searches can close and reopen ancestor directories, and then the limit is the stack size */
+
+	if (attr.fd_window && attr.parallel == 1)
+	{
+		struct rlimit rlim[1];
+		llong stack_size = -1, stack_limit = DEPTH_LIMIT;
+
+		if (getrlimit(RLIMIT_STACK, rlim) != -1 && rlim->rlim_cur != RLIM_INFINITY)
+			stack_size = (llong)rlim->rlim_cur;
+
+		/* -J threads get the same stack size as the main thread (within reason) */
+
+		if (attr.path_threads > 1)
+		{
+			if (stack_size == -1 || stack_size > THREAD_STACK_SIZE)
+				stack_size = THREAD_STACK_SIZE;
+
+			attr.thread_stack_size = (size_t)stack_size;
+		}
+
+		if (stack_size != -1)
+			stack_limit = (stack_size - DEPTH_STACK_RESERVE) / DEPTH_STACK_SIZE;
+
+		if (stack_limit > DEPTH_LIMIT)
+			stack_limit = DEPTH_LIMIT;
+
+		if (stack_limit > attr.depth_limit)
+			attr.depth_limit = stack_limit;
+	}
+
 	attr.depth_limit = env_int("RAWHIDE_TEST_DEPTH_LIMIT", 1, attr.depth_limit, attr.depth_limit);
 
 	if (opt_m > attr.depth_limit + 1)
@@ -1335,10 +1738,6 @@ int main(int argc, char *argv[])
 
 	debug(("min_depth = %lld, max_depth = %lld, depth_limit = %lld", attr.min_depth, attr.max_depth, attr.depth_limit));
 
-	/* Initialize a search stack for filesystem cycle detection */
-
-	attr.search_stack = (point_t *)malloc_or_fatalsys((attr.max_depth + 1) * sizeof(point_t));
-
 	/* Prepare to deallocate libmagic resources */
 
 	#ifdef HAVE_MAGIC
@@ -1347,24 +1746,54 @@ int main(int argc, char *argv[])
 
 	/* Find matches in the given directories (or the current working directory) */
 
-	for (; optind < argc; optind++)
-	{
-		if (optind == expr_index) /* Skip implicit expression */
-			continue;
+	if (opt_Z || opt_C)
+		rawhide_index_open((opt_Z) ? opt_Z : opt_C, opt_C != NULL);
 
-		if (rawhide_search(argv[optind]) == -1)
-			attr.exit_status = EXIT_FAILURE;
+	if (opt_G)
+		rawhide_ignore_init(opt_G);
 
-		++any;
-	}
+	if (opt_k)
+		rawhide_checkpoint_open(opt_k, opt_R);
+
+	if (opt_w)
+		rawhide_watch_init();
 
-	if (!any)
+	if (opt_z)
 	{
-		if (rawhide_search(".") == -1)
+		if (rawhide_search_index(opt_z, paths, ngiven) == -1)
 			attr.exit_status = EXIT_FAILURE;
 	}
+	else if (opt_list)
+	{
+		if (rawhide_search_list(opt_list) == -1)
+			attr.exit_status = EXIT_FAILURE;
+	}
+	else if (attr.path_threads > 1)
+	{
+		if (rawhide_search_paths(paths, npaths) == -1)
+			attr.exit_status = EXIT_FAILURE;
+	}
+	else
+	{
+		for (i = 0; i < npaths; ++i)
+			if (rawhide_search(paths[i]) == -1)
+				attr.exit_status = EXIT_FAILURE;
+	}
+
+	if (opt_Z || opt_C)
+		rawhide_index_close();
+
+	if (opt_k)
+		rawhide_checkpoint_close();
+
+	/* Then watch them for changes */
+
+	if (opt_w && rawhide_watch() == -1)
+		attr.exit_status = EXIT_FAILURE;
 
+	free(paths);
 	free(attr.search_stack);
+	free(attr.search_hash);
 	if (attr.user_shell_copy)
 		free(attr.user_shell_copy);
 	if (attr.defused_path)
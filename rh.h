@@ -74,6 +74,30 @@
 #define MAX_IDENT_LENGTH 200 /* Length limit of an identifier, username, or groupname */
 #endif
 
+/* Optimizer */
+
+#ifndef INLINE_SIZE
+#define INLINE_SIZE 16 /* Default maximum size of functions to inline (RAWHIDE_INLINE_SIZE) */
+#endif
+
+/* Directory depth limits */
+
+#ifndef FD_WINDOW
+#define FD_WINDOW 256 /* Default number of directory levels to keep open (RAWHIDE_FD_WINDOW) */
+#endif
+#ifndef DEPTH_LIMIT
+#define DEPTH_LIMIT 1000000 /* Depth limit when ancestor directories can be closed and reopened */
+#endif
+#ifndef DEPTH_STACK_SIZE
+#define DEPTH_STACK_SIZE 512 /* Stack space to allow for each directory level */
+#endif
+#ifndef DEPTH_STACK_RESERVE
+#define DEPTH_STACK_RESERVE (1024 * 1024) /* Stack space to reserve for everything else */
+#endif
+#ifndef THREAD_STACK_SIZE
+#define THREAD_STACK_SIZE (64 * 1024 * 1024) /* Maximum stack size for -J threads */
+#endif
+
 /* Debug subjects */
 
 #define DEBUG_EXTRA     0x01
@@ -81,6 +105,15 @@
 #define DEBUG_PARSER    0x04
 #define DEBUG_TRAVERSAL 0x08
 #define DEBUG_EXEC      0x10
+#define DEBUG_OPTIMIZER 0x20
+
+/* Thread-local storage (for the -P option's worker threads) */
+
+#if __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL __thread
+#endif
 
 /* Define type llong for 64 bits on 32-bit systems */
 
@@ -103,6 +136,24 @@ typedef long long unsigned int ullong;
 #define iswhiteout(statbuf) (((statbuf)->st_mode & S_IFMT) == S_IFWHT)
 #endif
 
+/* Define macros for what is needed to know about candidates (see rawhide_needs()) */
+
+#define NEED_PATH   0x0000 /* Only the path */
+#define NEED_TYPE   0x0001 /* The file type */
+#define NEED_MODE   0x0002 /* The file type and permissions */
+#define NEED_NLINK  0x0004 /* The number of hard links */
+#define NEED_UID    0x0008 /* The user/owner */
+#define NEED_GID    0x0010 /* The group */
+#define NEED_ATIME  0x0020 /* The access time */
+#define NEED_MTIME  0x0040 /* The modification time */
+#define NEED_CTIME  0x0080 /* The status change time */
+#define NEED_INO    0x0100 /* The inode number */
+#define NEED_SIZE   0x0200 /* The size */
+#define NEED_BLOCKS 0x0400 /* The number of blocks */
+#define NEED_DEV    0x0800 /* The device, rdev, or blksize */
+#define NEED_STAT   0x0fff /* Everything from stat(2) */
+#define NEED_BTIME  0x1000 /* The birth/created time */
+
 /* Define macros for user shell */
 
 #define USER_SHELLV_SIZE 11
@@ -144,6 +195,7 @@ struct instr_t
 {
 	void (*func)(llong); /* The function that implements the instruction */
 	llong value;         /* The argument to the function */
+	int op;              /* The opcode (see rawhide_compile()) */
 };
 
 /* Structure of a symbol */
@@ -163,8 +215,9 @@ struct symbol_t
 typedef struct point_t point_t;
 struct point_t
 {
-	dev_t dev; /* The search directory device */
-	ino_t ino; /* The search directory inode */
+	dev_t dev;  /* The search directory device */
+	ino_t ino;  /* The search directory inode */
+	llong next; /* The next search point in the same hash bucket (or -1) */
 };
 
 /* Structure defining the runtime environment */
@@ -177,6 +230,12 @@ typedef struct runtime_t runtime_t;
 struct runtime_t
 {
 	struct stat statbuf[1]; /* Stat info of the current candidate file */
+	int stat_done;          /* What attr.statbuf contains for it (NEED_*) */
+	int statx_btime_ok;     /* Did statx() return its birth/created time? (if stat_done & NEED_BTIME) */
+	struct timespec statx_btime[1]; /* Its birth/created time from statx() */
+	int needs;              /* What the search criteria need to know about candidates (NEED_*) */
+	int visit_needs;        /* What the visit function needs to know about matches (NEED_*) */
+	int path_pruning;       /* Can path patterns in the search criteria be used to prune directories? */
 	int dirsize_done;       /* Have we counted a directory's contents yet? */
 
 	char *search_path;      /* Starting search directory (For -L) */
@@ -208,6 +267,12 @@ struct runtime_t
 	char *fea_format;       /* fea encoded for the -L %x format (long-lived, on-demand) */
 	int fea_real;           /* Are there any real EAs (i.e. non-ACL/non-selinux ones on Linux)? */
 	llong fea_size;         /* Non-default size to allocate for extended attributes? */
+	size_t getdents_bufsize; /* Size of the getdents64(2) directory entry buffers (Linux) */
+	int io_uring;           /* Number of statx(2) requests to batch with io_uring, or 0 (Linux) */
+	int prefetch;           /* Number of prefetch threads to run ahead of sequential searches, or 0 */
+	llong prefetch_depth;   /* How many levels of directories the prefetch threads run ahead */
+	int fd_window;          /* Number of directory levels to keep open, or 0 (for all) */
+	llong bfs_memory;       /* Memory limit for the -W queue of directories */
 	int fea_solaris_no_sunwattr; /* Suppress ubiquitous SUNWattr_ro/SUNWattr_rw EAs on Solaris? */
 	int fea_solaris_no_statinfo; /* Suppress artificial stat(2) info EAs on Solaris? */
 	int implicit_expr_heuristic; /* Allow implicit search criteria expression heuristic */
@@ -252,9 +317,14 @@ struct runtime_t
 
 	int parent_fd;          /* File descriptor of parent directory */
 	char *basename;         /* Base name relative to parent_fd */
+	int dirent_type;        /* File type from the parent directory entry (0 if not known) */
+	ino_t dirent_ino;       /* Inode number from the parent directory entry (0 if not known) */
 	llong depth;            /* Relative depth of the current candidate file */
 	void (*visitf)(void);   /* Visitor/action function for matching entries */
 	point_t *search_stack;  /* Stack of search points (for loop detection) */
+	size_t search_stack_size; /* Number of search points allocated */
+	llong *search_hash;     /* Hash table of the search stack (bucket heads) */
+	size_t search_hash_size; /* Number of buckets in search_hash (power of 2) */
 
 	int debug_flags;        /* Debug bit mask to indicate debugging */
 	int prune;              /* Flag to indicate pruning */
@@ -264,10 +334,23 @@ struct runtime_t
 
 	llong min_depth;        /* Flag for the -m option: Minimum depth to report or act on */
 	llong max_depth;        /* Flag for the -M option: Maximum depth to search */
-	llong depth_limit;      /* System imposed depth limit (max open files - 5) */
+	llong depth_limit;      /* System imposed depth limit (max open files - 5, unless bounded by fd_window) */
 	int depth_first;        /* Flag for the -D option: depth-first search */
+	int breadth_first;      /* Flag for the -W option: breadth-first search */
 	int single_filesystem;  /* Flag for the -1 option: single filesystem */
+	int parallel;           /* Flag for the -P option: number of traversal threads */
+	int path_threads;       /* Flag for the -J option: number of search paths to search at once */
+	size_t thread_stack_size; /* Stack size for -J threads (or 0 for the default) */
+	int skip_revisits;      /* Flag for the -YY option: Don't search directories again via symlinks */
+	int inode_order;        /* Flag for the -O option: 1 = search in inode order, 2 = stat in inode order */
+	int name_order;         /* Search each directory's entries in name order (for the -k option) */
 	dev_t fs_dev;           /* The filesystem's dev (for the -1 option) */
+	char *skip_fstypes;     /* Flag for the -K option: Filesystem types not to search (comma-separated glob patterns) */
+	int shard;              /* Flag for the -A option: Which shard to search (from 1), or 0 */
+	int shards;             /* Flag for the -A option: Number of shards, or 0 */
+	llong shard_depth;      /* The depth at which subtrees are assigned to shards (for -A) */
+	llong inline_size;      /* The maximum size of functions to inline (see rawhide_optimize()) */
+	int optimize;           /* Optimize the search criteria (unless RAWHIDE_NO_OPTIMIZER is set)? */
 	int follow_symlinks;    /* Flag for the -y and -Y options: 0=No 1=y 2=Y */
 	int followed;           /* Have we followed a symlink for this candidate? */
 	int tty;                /* Is stdout a tty? (to default to -q) */
@@ -388,7 +471,7 @@ extern int token;           /* Current token code */
 extern int tokendigits;     /* Number of decimal digits (to check nanoseconds) */
 
 extern instr_t Program[];   /* Program instructions */
-extern llong PC;            /* Program counter */
+extern THREAD_LOCAL llong PC; /* Program counter */
 extern llong startPC;       /* Initial program counter */
 
 extern char Strbuf[];       /* Storage for string literals */
@@ -397,11 +480,11 @@ extern llong strfree;       /* Index into Strbuf for the next string literal */
 extern reffile_t RefFile[]; /* Storage for reference files (e.g., "fpath".mtime) */
 extern llong reffree;       /* Index into RefFile for the next reference file */
 
-extern llong Stack[];       /* Stack */
-extern llong SP;            /* Stack pointer */
-extern llong FP;            /* Frame pointer */
+extern THREAD_LOCAL llong *Stack; /* Stack */
+extern THREAD_LOCAL llong SP;     /* Stack pointer */
+extern THREAD_LOCAL llong FP;     /* Frame pointer */
 
-extern runtime_t attr;      /* Configuration and runtime state */
+extern THREAD_LOCAL runtime_t attr; /* Configuration and runtime state */
 
 extern char *expstr;        /* The -e option argument (search criteria expression) */
 extern char *expfname;      /* The -f option argument (filename) or current config file */
@@ -112,6 +112,12 @@ void c_uniminus(llong i) { Stack[SP - 1] = -Stack[SP - 1]; }
 void c_qm(llong i)    { PC = (Stack[SP - 1]) ? PC : i; SP--; }
 void c_colon(llong i) { PC = i; }
 
+/* Conditional branches that keep their operand (see rawhide_optimize()) */
+
+void c_jt(llong i)    { if (Stack[SP - 1]) Stack[SP - 1] = 1, PC = i; else SP--; }
+void c_jf(llong i)    { if (Stack[SP - 1]) SP--; else PC = i; }
+void c_bool(llong i)  { Stack[SP - 1] = !!Stack[SP - 1]; }
+
 void c_comma(llong i) { Stack[SP - 2] = Stack[SP - 1]; SP--; }
 
 /* Functions */
@@ -139,26 +145,20 @@ void c_param(llong i) { Stack[SP++] = Stack[FP + i]; }
 static llong get_dirsize(struct stat *statbuf, const char *name)
 {
 	int dir_fd;
-	DIR *dir;
-	struct dirent *entry;
+	rhdir_t *dir;
 
 	if ((dir_fd = openat(attr.parent_fd, name, 0)) == -1)
 		return (llong)statbuf->st_size;
 
-	if (!(dir = fdopendir(dir_fd)))
+	if (!(dir = rawhide_opendir(dir_fd)))
 		return close(dir_fd), (llong)statbuf->st_size;
 
 	statbuf->st_size = 0;
 
-	while ((entry = readdir(dir)))
-	{
-		if (entry->d_name[0] == '.' && (!entry->d_name[1] || (entry->d_name[1] == '.' && !entry->d_name[2])))
-			continue;
-
+	while (rawhide_readdir(dir))
 		++statbuf->st_size;
-	}
 
-	closedir(dir);
+	rawhide_closedir(dir);
 
 	return (llong)statbuf->st_size;
 }
@@ -179,12 +179,21 @@ static llong dirsize(void)
 
 static llong rdirsize(int i)
 {
-	if (RefFile[i].dirsize_done)
-		return (llong)RefFile[i].statbuf->st_size;
+	llong size;
+
+	rawhide_lock(); /* Reference files are shared by -P threads */
 
-	RefFile[i].dirsize_done = 1;
+	if (!RefFile[i].dirsize_done)
+	{
+		RefFile[i].dirsize_done = 1;
+		get_dirsize(RefFile[i].statbuf, Strbuf + RefFile[i].fpathi);
+	}
 
-	return get_dirsize(RefFile[i].statbuf, Strbuf + RefFile[i].fpathi);
+	size = (llong)RefFile[i].statbuf->st_size;
+
+	rawhide_unlock();
+
+	return size;
 }
 
 static llong tdirsize(void)
@@ -308,6 +317,15 @@ llong get_btime(void)
 
 	struct statx statxbuf[1];
 
+	if (!attr.btime_done && attr.stat_done & NEED_BTIME)
+	{
+		/* Already fetched by the same statx() as the other fields */
+
+		attr.btime_ok = attr.statx_btime_ok;
+		*attr.btime = *attr.statx_btime;
+		attr.btime_done = 1;
+	}
+
 	if (!attr.btime_done)
 	{
 		char *name = (attr.parent_fd == AT_FDCWD) ? attr.fpath : attr.basename;
@@ -417,9 +435,14 @@ static llong get_linkbtime(void)
 
 static llong get_refbtime(llong i)
 {
+	llong btime;
 	#if HAVE_STATX_BTIME
-
 	struct statx statxbuf[1];
+	#endif
+
+	rawhide_lock(); /* Reference files are shared by -P threads */
+
+	#if HAVE_STATX_BTIME
 
 	if (!RefFile[i].btime_done)
 	{
@@ -467,7 +490,11 @@ static llong get_refbtime(llong i)
 
 	#endif
 
-	return (RefFile[i].btime_ok) ? BTIME(RefFile[i].btime) : 0;
+	btime = (RefFile[i].btime_ok) ? BTIME(RefFile[i].btime) : 0;
+
+	rawhide_unlock();
+
+	return btime;
 }
 
 /* Built-ins */
@@ -562,12 +589,16 @@ void c_strlen(llong i)
 
 void c_nouser(llong i)
 {
+	rawhide_lock(); /* getpwuid() isn't thread-safe (for -P) */
 	Stack[SP++] = !getpwuid(attr.statbuf->st_uid);
+	rawhide_unlock();
 }
 
 void c_nogroup(llong i)
 {
+	rawhide_lock(); /* getgrgid() isn't thread-safe (for -P) */
 	Stack[SP++] = !getgrgid(attr.statbuf->st_gid);
+	rawhide_unlock();
 }
 
 void c_readable(llong i)
@@ -676,13 +707,14 @@ static pcre2_code *pcre2_compile_checked(const char *pattern, uint32_t options)
 }
 
 /* Wrapper for pcre2_compile() that caches the last two compiled regexes. That should speed up most searches. */
+/* The cache is per-thread (for -P), so each traversal thread must call pcre2_cache_free() when finished. */
 
 static pcre2_code *pcre2_compile_cached(const char *regex, uint32_t options)
 {
-	static const char *regex_cache[2];
-	static uint32_t options_cache[2];
-	static pcre2_code *code_cache[2];
-	static int mru;
+	static THREAD_LOCAL const char *regex_cache[2];
+	static THREAD_LOCAL uint32_t options_cache[2];
+	static THREAD_LOCAL pcre2_code *code_cache[2];
+	static THREAD_LOCAL int mru;
 
 	/* Clear the cache when regex is null */
 
@@ -977,6 +1009,30 @@ void c_reimime(llong i) { mime_re(i, PCRE2_CASELESS); }
 #endif
 #endif
 
+/* Filesystem type (from the mount table, see rawhide_fstype()) */
+
+static void fstype_glob(llong i, int options)
+{
+	Stack[SP++] = attr.fnmatch(&Strbuf[i], rawhide_fstype(attr.statbuf->st_dev), FNM_EXTMATCH | options) == 0;
+}
+
+void c_fstype(llong i)  { fstype_glob(i, 0); }
+#ifdef FNM_CASEFOLD
+void c_ifstype(llong i) { fstype_glob(i, FNM_CASEFOLD); }
+#endif
+
+#ifdef HAVE_PCRE2
+
+static void fstype_re(llong i, int options)
+{
+	Stack[SP++] = rematch(&Strbuf[i], rawhide_fstype(attr.statbuf->st_dev), -1, PCRE2_DOTALL | options);
+}
+
+void c_refstype(llong i)  { fstype_re(i, 0); }
+void c_reifstype(llong i) { fstype_re(i, PCRE2_CASELESS); }
+
+#endif
+
 /* Load ACLs into attr.facl (and attr.facl_verbose on FreeBSD/Solaris), which must be deallocated eventually */
 
 #define failure(args) if (want) { errorsys args; attr.exit_status = EXIT_FAILURE; }
@@ -1725,6 +1781,10 @@ void c_sh(llong i)
 	char command[CMDBUFSIZE];
 	int dot_fd;
 
+	/* The cwd is shared by -P threads */
+
+	rawhide_lock();
+
 	/* Change cwd to the file's directory (to avoid path-based race conditions) */
 
 	dot_fd = chdir_local(0);
@@ -1742,6 +1802,8 @@ void c_sh(llong i)
 
 		close(dot_fd);
 	}
+
+	rawhide_unlock();
 }
 
 /*  Execute a shell command with usyscmd() */
@@ -1751,6 +1813,10 @@ void c_ush(llong i)
 	char command[CMDBUFSIZE];
 	int dot_fd;
 
+	/* The cwd is shared by -P threads */
+
+	rawhide_lock();
+
 	/* Change cwd to the file's directory (to avoid path-based race conditions) */
 
 	dot_fd = chdir_local(0);
@@ -1768,6 +1834,8 @@ void c_ush(llong i)
 
 		close(dot_fd);
 	}
+
+	rawhide_unlock();
 }
 
 /* Reference file fields */
@@ -1807,12 +1875,16 @@ void r_attr(llong i)
 {
 	check_reference(i, "attr");
 
+	rawhide_lock();
+
 	if (!RefFile[i].attr_done)
 	{
 		RefFile[i].attr_done = 1;
 		fgetflags(Strbuf + RefFile[i].fpathi, &RefFile[i].attr);
 	}
 
+	rawhide_unlock();
+
 	Stack[SP++] = RefFile[i].attr;
 }
 
@@ -1820,12 +1892,16 @@ void r_proj(llong i)
 {
 	check_reference(i, "proj");
 
+	rawhide_lock();
+
 	if (!RefFile[i].proj_done)
 	{
 		RefFile[i].proj_done = 1;
 		fgetproject(Strbuf + RefFile[i].fpathi, &RefFile[i].proj);
 	}
 
+	rawhide_unlock();
+
 	Stack[SP++] = RefFile[i].proj;
 }
 
@@ -1833,12 +1909,16 @@ void r_gen(llong i)
 {
 	check_reference(i, "gen");
 
+	rawhide_lock();
+
 	if (!RefFile[i].gen_done)
 	{
 		RefFile[i].gen_done = 1;
 		fgetversion(Strbuf + RefFile[i].fpathi, &RefFile[i].gen);
 	}
 
+	rawhide_unlock();
+
 	Stack[SP++] = RefFile[i].gen;
 }
 
@@ -1848,12 +1928,16 @@ void r_attr(llong i)
 {
 	check_reference(i, "attr");
 
+	rawhide_lock();
+
 	if (!RefFile[i].attr_done)
 	{
 		RefFile[i].attr_done = 1;
 		RefFile[i].attr = RefFile[i].statbuf->st_flags;
 	}
 
+	rawhide_unlock();
+
 	Stack[SP++] = RefFile[i].attr;
 }
 
@@ -1863,6 +1947,8 @@ void r_attr(llong i)
 {
 	check_reference(i, "attr");
 
+	rawhide_lock();
+
 	if (!RefFile[i].attr_done)
 	{
 		RefFile[i].attr_done = 1;
@@ -1870,6 +1956,8 @@ void r_attr(llong i)
 		get_solaris_attr(AT_FDCWD, Strbuf + RefFile[i].fpathi, &RefFile[i].attr, &RefFile[i].btime_ok, RefFile[i].btime);
 	}
 
+	rawhide_unlock();
+
 	Stack[SP++] = RefFile[i].attr;
 }
 
@@ -1954,6 +2042,9 @@ char *instruction_name(void (*func)(llong))
 		(func == c_uniminus) ? "uniminus" :
 		(func == c_qm) ? "qm" :
 		(func == c_colon) ? "colon" :
+		(func == c_jt) ? "jt" :
+		(func == c_jf) ? "jf" :
+		(func == c_bool) ? "bool" :
 		(func == c_comma) ? "comma" :
 		(func == c_param) ? "param" :
 		(func == c_func) ? "func" :
@@ -2038,6 +2129,14 @@ char *instruction_name(void (*func)(llong))
 		(func == c_reimime) ? "reimime" :
 		#endif
 		#endif
+		(func == c_fstype) ? "fstype" :
+		#ifdef FNM_CASEFOLD
+		(func == c_ifstype) ? "ifstype" :
+		#endif
+		#ifdef HAVE_PCRE2
+		(func == c_refstype) ? "refstype" :
+		(func == c_reifstype) ? "reifstype" :
+		#endif
 		#ifdef HAVE_ACL
 		(func == c_acl) ? "acl" :
 		#ifdef FNM_CASEFOLD
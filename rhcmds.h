@@ -46,6 +46,9 @@ void c_bitnot(llong i);
 void c_uniminus(llong i);
 void c_qm(llong i);
 void c_colon(llong i);
+void c_jt(llong i);
+void c_jf(llong i);
+void c_bool(llong i);
 void c_comma(llong i);
 void c_param(llong i);
 void c_func(llong i);
@@ -126,6 +129,14 @@ void c_remime(llong i);
 void c_reimime(llong i);
 #endif
 #endif
+void c_fstype(llong i);
+#ifdef FNM_CASEFOLD
+void c_ifstype(llong i);
+#endif
+#ifdef HAVE_PCRE2
+void c_refstype(llong i);
+void c_reifstype(llong i);
+#endif
 void c_body(llong i);
 #ifdef FNM_CASEFOLD
 void c_ibody(llong i);
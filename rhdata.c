@@ -28,7 +28,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
 #include <fnmatch.h>
 #include <time.h>
 #include <sys/stat.h>
@@ -52,7 +54,7 @@ int token;                           /* Current token code */
 int tokendigits;                     /* Number of decimal digits (to check nanoseconds) */
 
 instr_t Program[MAX_PROGRAM_SIZE];   /* Program instructions */
-llong PC;                            /* Program counter */
+THREAD_LOCAL llong PC;               /* Program counter */
 llong startPC;                       /* Initial program counter */
 
 char Strbuf[MAX_DATA_SIZE];          /* Storage for string literals */
@@ -61,11 +63,12 @@ llong strfree = 0;                   /* Index into Strbuf for the next string li
 reffile_t RefFile[MAX_REFFILE_SIZE]; /* Storage for reference files */
 llong reffree = 0;                   /* Index into RefFile for the next reference file */
 
-llong Stack[MAX_STACK_SIZE + 3];     /* Stack */
-llong SP;                            /* Stack pointer */
-llong FP;                            /* Frame pointer */
+static llong MainStack[MAX_STACK_SIZE + 3]; /* Stack (main thread) */
+THREAD_LOCAL llong *Stack = MainStack; /* Stack (-P workers have their own) */
+THREAD_LOCAL llong SP;               /* Stack pointer */
+THREAD_LOCAL llong FP;               /* Frame pointer */
 
-runtime_t attr;                      /* Configuration and runtime state */
+THREAD_LOCAL runtime_t attr;         /* Configuration and runtime state */
 
 char *expstr;   /* The -e option argument (search criteria expression) */
 char *expfname; /* The -f option argument (filename) or current config file */
@@ -300,6 +303,15 @@ static symbol_t init_syms[] =
 #endif
 #endif
 
+	{ ".fstype",   PATMOD, 0, c_fstype,   NULL },
+#ifdef FNM_CASEFOLD
+	{ ".ifstype",  PATMOD, 0, c_ifstype,  NULL },
+#endif
+#ifdef HAVE_PCRE2
+	{ ".refstype", PATMOD, 0, c_refstype, NULL },
+	{ ".reifstype", PATMOD, 0, c_reifstype, NULL },
+#endif
+
 #ifdef HAVE_ACL
 	{ ".acl",      PATMOD, 0, c_acl,     NULL },
 #ifdef FNM_CASEFOLD
@@ -511,26 +523,1991 @@ int rawhide_instruction(void (*func)(llong), llong value)
 
 /*
 
-llong rawhide_execute(void);
+The optimizer
 
-Execute the program stored in Program.
-Each element of Program contains a pointer to a function.
-The program is NULL-terminated.
-Returns the value of the expression.
+parse_program() compiles "a && b" and "a || b" to the following (where qm
+and colon jump to the labels):
+
+	a qm(1) b qm(2) number(1) colon(3) 2: number(0) 3: colon(4) 1: number(0) 4:
+	a qm(1) number(1) colon(2) 1: b 2: qm(3) number(1) colon(4) 3: number(0) 4:
+
+Every intermediate result is normalized to 0 or 1, and jumps go to other
+jumps. rawhide_optimize() rewrites the program with conditional branches
+that leave their operand on the stack when they jump (jt jumps when it's
+non-zero, leaving 1, and jf jumps when it's zero), and with a separate
+normalization instruction (bool), so the above become:
+
+	a jf(1) b bool 1:
+	a jt(1) b bool 1:
+
+It then threads jumps to jumps, removes normalizations that aren't needed
+(e.g., the bool above when b is a comparison), removes jumps to the next
+instruction, and removes unreachable code (including the functions that
+are never called).
+
+It also folds constants (e.g., "now - 2 * day" becomes a single number),
+including calls to functions whose bodies are constant (with constant
+arguments), removes operations that don't change anything (e.g., x + 0,
+x * 1), and resolves conditional branches on constants.
+
+When there's nothing left to do, calls to functions that are small enough
+(attr.inline_size, RAWHIDE_INLINE_SIZE) and aren't recursive are replaced
+with a copy of the function's body (see optimize_inline()), and it starts
+again. The "parser" debug subject shows which functions are inlined, and
+the "optimizer" debug subject lists the program before and after.
 
 */
 
-llong rawhide_execute(void)
+#define opt_jump(func) ((func) == c_qm || (func) == c_colon || (func) == c_jt || (func) == c_jf)
+
+static char *opt_dead;   /* For each instruction: has it been removed? */
+static llong *opt_refs;  /* For each instruction: the number of jumps to it */
+static llong *opt_qrefs; /* For each instruction: the number of those that are qm or colon */
+static int opt_stale;    /* Do opt_refs and opt_qrefs need to be recounted? */
+
+/*
+
+static llong opt_next(llong pc);
+
+Return the first instruction at or after the given pc that hasn't been
+removed.
+
+*/
+
+static llong opt_next(llong pc)
 {
-	for (SP = 0, PC = startPC; Program[PC].func; PC++)
+	while (pc < PC && opt_dead[pc])
+		++pc;
+
+	return pc;
+}
+
+/*
+
+static llong opt_prev(llong pc);
+
+Return the last instruction before the given pc that hasn't been removed
+(or -1 if there isn't one).
+
+*/
+
+static llong opt_prev(llong pc)
+{
+	for (--pc; pc >= 0 && opt_dead[pc]; --pc)
+	{}
+
+	return pc;
+}
+
+/*
+
+static llong opt_target(llong pc);
+
+Return the instruction that the jump at the given pc goes to.
+
+*/
+
+static llong opt_target(llong pc)
+{
+	return opt_next(Program[pc].value + 1);
+}
+
+/*
+
+static int opt_is(llong pc, void (*func)(llong));
+
+Return whether or not the instruction at the given pc (if any) is func.
+
+*/
+
+static int opt_is(llong pc, void (*func)(llong))
+{
+	return pc < PC && Program[pc].func == func;
+}
+
+/*
+
+static int opt_is_number(llong pc, llong value);
+
+Return whether or not the instruction at the given pc (if any) pushes the
+given number.
+
+*/
+
+static int opt_is_number(llong pc, llong value)
+{
+	return opt_is(pc, c_number) && Program[pc].value == value;
+}
+
+/*
+
+static int opt_boolean(llong pc);
+
+Return whether or not the instruction at the given pc only produces 0 or 1.
+
+*/
+
+static int opt_boolean(llong pc)
+{
+	void (*func)(llong) = Program[pc].func;
+
+	return func == c_lt || func == c_le || func == c_gt || func == c_ge || func == c_eq || func == c_ne ||
+		func == c_not || func == c_bool || (func == c_number && (Program[pc].value == 0 || Program[pc].value == 1));
+}
+
+/*
+
+static int opt_truth_test(llong pc);
+
+Return whether or not the instruction at the given pc only cares whether
+its operand is zero or non-zero.
+
+*/
+
+static int opt_truth_test(llong pc)
+{
+	void (*func)(llong) = Program[pc].func;
+
+	return func == c_qm || func == c_jt || func == c_jf || func == c_bool || func == c_not;
+}
+
+/*
+
+static int opt_count(void);
+
+Count the jumps to each instruction, unless nothing has changed since they
+were last counted. Returns 1 (for use in conditions).
+
+*/
+
+static int opt_count(void)
+{
+	llong pc, target;
+
+	if (!opt_stale)
+		return 1;
+
+	memset(opt_refs, 0, PC * sizeof(llong));
+	memset(opt_qrefs, 0, PC * sizeof(llong));
+
+	for (pc = 0; pc < PC; ++pc)
 	{
-		(*Program[PC].func)(Program[PC].value);
+		if (opt_dead[pc] || !opt_jump(Program[pc].func))
+			continue;
 
-		if (SP >= MAX_STACK_SIZE)
-			fatal("stack overflow");
+		target = opt_target(pc);
+		++opt_refs[target];
+
+		if (Program[pc].func == c_qm || Program[pc].func == c_colon)
+			++opt_qrefs[target];
 	}
 
-	return Stack[0];
+	opt_stale = 0;
+
+	return 1;
+}
+
+/*
+
+static int opt_fold(void (*func)(llong), llong a, llong b, llong *result);
+
+Evaluate the binary operator instruction func with the constant operands a
+and b, and store the result in *result. Returns whether or not that was
+possible. Division by zero, overflowing division, and out of range shifts
+are left for the program to encounter at run time.
+
+*/
+
+static int opt_fold(void (*func)(llong), llong a, llong b, llong *result)
+{
+	if (func == c_le)
+		*result = a <= b;
+	else if (func == c_lt)
+		*result = a < b;
+	else if (func == c_ge)
+		*result = a >= b;
+	else if (func == c_gt)
+		*result = a > b;
+	else if (func == c_ne)
+		*result = a != b;
+	else if (func == c_eq)
+		*result = a == b;
+	else if (func == c_bitor)
+		*result = a | b;
+	else if (func == c_bitand)
+		*result = a & b;
+	else if (func == c_bitxor)
+		*result = a ^ b;
+	else if (func == c_plus)
+		*result = (llong)((ullong)a + (ullong)b);
+	else if (func == c_minus)
+		*result = (llong)((ullong)a - (ullong)b);
+	else if (func == c_mul)
+		*result = (llong)((ullong)a * (ullong)b);
+	else if (func == c_div && b != 0 && b != -1)
+		*result = a / b;
+	else if (func == c_mod && b != 0 && b != -1)
+		*result = a % b;
+	else if (func == c_lshift && b >= 0 && b < 64)
+		*result = a << b;
+	else if (func == c_rshift && b >= 0 && b < 64)
+		*result = a >> b;
+	else
+		return 0;
+
+	return 1;
+}
+
+/*
+
+static int opt_fold_unary(void (*func)(llong), llong a, llong *result);
+
+Evaluate the unary operator instruction func with the constant operand a,
+and store the result in *result. Returns whether or not that was possible.
+
+*/
+
+static int opt_fold_unary(void (*func)(llong), llong a, llong *result)
+{
+	if (func == c_not)
+		*result = !a;
+	else if (func == c_bool)
+		*result = !!a;
+	else if (func == c_bitnot)
+		*result = ~a;
+	else if (func == c_uniminus)
+		*result = (llong)-(ullong)a;
+	else
+		return 0;
+
+	return 1;
+}
+
+/*
+
+static int opt_identity(void (*func)(llong), llong b);
+
+Return whether or not the binary operator instruction func leaves its left
+operand unchanged when its right operand is the constant b (e.g., x + 0).
+
+*/
+
+static int opt_identity(void (*func)(llong), llong b)
+{
+	if (b == 0)
+		return func == c_plus || func == c_minus || func == c_bitor || func == c_bitxor || func == c_lshift || func == c_rshift;
+
+	if (b == 1)
+		return func == c_mul || func == c_div;
+
+	if (b == -1)
+		return func == c_bitand;
+
+	return 0;
+}
+
+/*
+
+static int optimize_unreachable(void);
+
+Remove the instructions that can't be reached from startPC (including
+functions that are never called). Returns the number removed.
+
+*/
+
+static int optimize_unreachable(void)
+{
+	llong *todo, ntodo = 0, pc;
+	char *seen;
+	void (*func)(llong);
+	int changes = 0;
+
+	seen = malloc_or_fatalsys(PC);
+	memset(seen, 0, PC);
+	todo = malloc_or_fatalsys((2 * PC + 1) * sizeof(llong));
+	todo[ntodo++] = startPC;
+
+	while (ntodo)
+	{
+		for (pc = opt_next(todo[--ntodo]); pc < PC && !seen[pc]; pc = opt_next(pc + 1))
+		{
+			seen[pc] = 1;
+			func = Program[pc].func;
+
+			if (!func || func == c_return)
+				break;
+
+			if (opt_jump(func))
+				todo[ntodo++] = opt_target(pc);
+
+			if (func == c_colon)
+				break;
+
+			if (func == c_func && !seen[Program[pc].value])
+			{
+				seen[Program[pc].value] = 1;
+				todo[ntodo++] = Program[pc].value + 1;
+			}
+		}
+	}
+
+	for (pc = 0; pc < PC; ++pc)
+	{
+		if (!seen[pc] && !opt_dead[pc])
+		{
+			opt_dead[pc] = 1;
+			++changes;
+		}
+	}
+
+	free(seen);
+	free(todo);
+
+	return changes;
+}
+
+/*
+
+static int optimize_peephole(void);
+
+Rewrite short sequences of instructions (see above). Returns the number of
+changes.
+
+*/
+
+static int optimize_peephole(void)
+{
+	llong pc, n1, n2, n3, target, prev, result;
+	void (*func)(llong);
+	int changes = 0, i;
+
+	#define opt_changed() (++changes, opt_stale = 1)
+
+	for (pc = 0; pc < PC; ++pc)
+	{
+		if (opt_dead[pc] || !(func = Program[pc].func))
+			continue;
+
+		n1 = opt_next(pc + 1);
+		n2 = (n1 < PC) ? opt_next(n1 + 1) : PC;
+		n3 = (n2 < PC) ? opt_next(n2 + 1) : PC;
+
+		/* Constant folding: number number operator */
+
+		if (func == c_number && opt_is(n1, c_number) && n2 < PC && opt_fold(Program[n2].func, Program[pc].value, Program[n1].value, &result) &&
+			opt_count() && !opt_refs[n1] && !opt_refs[n2])
+		{
+			Program[pc].value = result;
+			opt_dead[n1] = opt_dead[n2] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* Reassociation: (x & a) & b is x & (a & b) (and likewise for | and ^) */
+
+		if (func == c_number && n1 < PC && (Program[n1].func == c_bitand || Program[n1].func == c_bitor || Program[n1].func == c_bitxor) &&
+			opt_is(n2, c_number) && opt_is(n3, Program[n1].func) && opt_count() && !opt_refs[n1] && !opt_refs[n2] && !opt_refs[n3])
+		{
+			opt_fold(Program[n1].func, Program[pc].value, Program[n2].value, &Program[pc].value);
+			opt_dead[n2] = opt_dead[n3] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* number number comma */
+
+		if (func == c_number && opt_is(n1, c_number) && opt_is(n2, c_comma) && opt_count() && !opt_refs[n1] && !opt_refs[n2])
+		{
+			Program[pc].value = Program[n1].value;
+			opt_dead[n1] = opt_dead[n2] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* number operator (unary) */
+
+		if (func == c_number && n1 < PC && opt_fold_unary(Program[n1].func, Program[pc].value, &result) && opt_count() && !opt_refs[n1])
+		{
+			Program[pc].value = result;
+			opt_dead[n1] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* Algebraic identities: x + 0, x * 1, x & -1, etc. */
+
+		if (func == c_number && n1 < PC && opt_identity(Program[n1].func, Program[pc].value) && opt_count() && !opt_refs[n1])
+		{
+			opt_dead[pc] = opt_dead[n1] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* Conditional branches on a constant always or never jump */
+
+		if (func == c_number && n1 < PC && (Program[n1].func == c_qm || Program[n1].func == c_jt || Program[n1].func == c_jf) && opt_count() && !opt_refs[n1])
+		{
+			int jump = (Program[n1].func == c_jt) ? Program[pc].value != 0 : Program[pc].value == 0;
+
+			if (!jump)
+				opt_dead[pc] = opt_dead[n1] = 1;
+			else
+			{
+				if (Program[n1].func == c_qm)
+					opt_dead[pc] = 1;
+				else if (Program[n1].func == c_jt)
+					Program[pc].value = 1;
+
+				Program[n1].func = c_colon;
+			}
+
+			opt_changed();
+
+			continue;
+		}
+
+		/* Calls to functions whose bodies are constant (with constant arguments) */
+
+		if (func == c_func)
+		{
+			llong header = Program[pc].value, nparams = Program[header].value, body = opt_next(header + 1), arg = pc;
+
+			if (opt_is(body, c_number) && opt_is(opt_next(body + 1), c_return) && opt_count())
+			{
+				for (i = 0; i < nparams && (arg = opt_prev(arg)) >= 0 && opt_is(arg, c_number) && !opt_refs[opt_next(arg + 1)]; ++i)
+				{}
+
+				if (i == nparams)
+				{
+					for (arg = pc, i = 0; i < nparams; ++i)
+						opt_dead[arg = opt_prev(arg)] = 1;
+
+					Program[pc].func = c_number;
+					Program[pc].value = Program[body].value;
+					opt_changed();
+
+					continue;
+				}
+			}
+		}
+
+		/* qm number(1) colon number(0) is bool */
+
+		if (func == c_qm && opt_is_number(n1, 1) && opt_is(n2, c_colon) && opt_is_number(n3, 0) &&
+			opt_target(pc) == n3 && opt_target(n2) == opt_next(n3 + 1) &&
+			opt_count() && !opt_refs[n1] && !opt_refs[n2] && opt_refs[n3] == 1)
+		{
+			Program[pc].func = c_bool;
+			Program[pc].value = 0;
+			opt_dead[n1] = opt_dead[n2] = opt_dead[n3] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* jt over number(0) is bool */
+
+		if (func == c_jt && opt_is_number(n1, 0) && opt_target(pc) == n2 && opt_count() && !opt_refs[n1])
+		{
+			Program[pc].func = c_bool;
+			Program[pc].value = 0;
+			opt_dead[n1] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* qm number(1) colon is jt */
+
+		if (func == c_qm && opt_is_number(n1, 1) && opt_is(n2, c_colon) && opt_target(pc) == opt_next(n2 + 1) &&
+			opt_count() && !opt_refs[n1] && !opt_refs[n2])
+		{
+			Program[pc].func = func = c_jt;
+			Program[pc].value = Program[n2].value;
+			opt_dead[n1] = opt_dead[n2] = 1;
+			opt_changed();
+		}
+
+		/* qm to number(0) is jf to after it */
+
+		if (func == c_qm && opt_is_number(target = opt_target(pc), 0))
+		{
+			Program[pc].func = func = c_jf;
+			Program[pc].value = target;
+			opt_changed();
+		}
+
+		/* Jump threading */
+
+		for (i = 0; opt_jump(func) && i < 100; ++i)
+		{
+			target = opt_target(pc);
+
+			if (opt_is(target, c_colon) || (func == c_jt && opt_is(target, c_jt)) || (func == c_jf && opt_is(target, c_jf)))
+				Program[pc].value = Program[target].value;
+			else if ((func == c_jt || func == c_jf) && opt_is(target, c_bool))
+				Program[pc].value = target;
+			else if (func == c_jf && opt_is(target, c_qm))
+				Program[pc].func = func = c_qm, Program[pc].value = Program[target].value;
+			else if (func == c_jf && opt_is(target, c_jt))
+				Program[pc].func = func = c_qm, Program[pc].value = target;
+			else
+				break;
+
+			opt_changed();
+		}
+
+		/* colon to the next instruction */
+
+		if (func == c_colon && opt_target(pc) == n1)
+		{
+			opt_dead[pc] = 1;
+			opt_changed();
+
+			continue;
+		}
+
+		/* bool before a truth test, or after something that's already 0 or 1 */
+
+		if (func == c_bool)
+		{
+			prev = opt_prev(pc);
+
+			if ((n1 < PC && opt_truth_test(n1)) ||
+				(prev >= 0 && (opt_boolean(prev) || Program[prev].func == c_colon) && opt_count() && !opt_qrefs[pc]))
+			{
+				opt_dead[pc] = 1;
+				opt_changed();
+
+				continue;
+			}
+		}
+
+		/* not not is bool */
+
+		if (func == c_not && opt_is(n1, c_not) && opt_count() && !opt_refs[n1])
+		{
+			Program[pc].func = c_bool;
+			opt_dead[n1] = 1;
+			opt_changed();
+		}
+	}
+
+	#undef opt_changed
+
+	return changes;
+}
+
+/*
+
+static void opt_relocate_symbols(llong *newpc);
+
+Update the functions in the symbol table with their new locations (or -1
+if they've been removed).
+
+*/
+
+static void opt_relocate_symbols(llong *newpc)
+{
+	symbol_t *s;
+
+	for (s = symbols; s; s = s->next)
+		if (s->type == FUNCTION)
+			s->value = (s->value >= 0 && s->value < PC && !opt_dead[s->value]) ? newpc[s->value] : -1;
+}
+
+#ifndef NDEBUG
+/*
+
+static void debug_parser(const char *format, ...);
+
+Output a parser debug message to stderr, if requested.
+
+*/
+
+static void debug_parser(const char *format, ...)
+{
+	va_list args;
+
+	if (!(attr.debug_flags & DEBUG_PARSER))
+		return;
+
+	va_start(args, format);
+	fprintf(stderr, "%s: ", "parser");
+	vfprintf(stderr, format, args);
+	fprintf(stderr, "\n");
+	va_end(args);
+}
+
+/*
+
+static const char *opt_function_name(llong header);
+
+Return the name of the function whose header is at the given pc.
+
+*/
+
+static const char *opt_function_name(llong header)
+{
+	symbol_t *s;
+
+	for (s = symbols; s; s = s->next)
+		if (s->type == FUNCTION && s->value == header)
+			return s->name;
+
+	return "?";
+}
+
+#define debug(args) debug_parser args
+#else
+#define debug(args)
+#endif
+
+/*
+
+static int opt_simple(llong pc);
+
+Return whether or not the instruction at the given pc can be used as a
+function argument that is substituted for the parameter when the function
+is inlined (i.e., it has no side effects, and it's cheap to repeat).
+
+*/
+
+static int opt_simple(llong pc)
+{
+	void (*func)(llong) = Program[pc].func;
+
+	return func == c_number || func == c_param || func == c_depth ||
+		func == c_dev || func == c_ino || func == c_mode || func == c_nlink || func == c_uid || func == c_gid ||
+		func == c_rdev || func == c_size || func == c_blksize || func == c_blocks ||
+		func == c_atime || func == c_mtime || func == c_ctime;
+}
+
+/*
+
+static int opt_calls(llong header, llong target, char *seen);
+
+Return whether or not the function whose header is at the given pc calls
+the function whose header is at target (directly or indirectly). The seen
+array marks the functions that have already been checked.
+
+*/
+
+static int opt_calls(llong header, llong target, char *seen)
+{
+	llong pc;
+
+	if (seen[header])
+		return 0;
+
+	seen[header] = 1;
+
+	for (pc = opt_next(header + 1); pc < PC && Program[pc].func != c_return; pc = opt_next(pc + 1))
+		if (Program[pc].func == c_func && (Program[pc].value == target || opt_calls(Program[pc].value, target, seen)))
+			return 1;
+
+	return 0;
+}
+
+/*
+
+static llong opt_inlinable(llong header, char *seen);
+
+Return the number of instructions in the body of the function whose header
+is at the given pc, if it's small enough to be inlined (attr.inline_size),
+and it isn't recursive. Otherwise, return -1.
+
+*/
+
+static llong opt_inlinable(llong header, char *seen)
+{
+	llong pc, size = 0;
+
+	for (pc = opt_next(header + 1); pc < PC && Program[pc].func != c_return; pc = opt_next(pc + 1))
+		if (++size > attr.inline_size)
+			return -1;
+
+	memset(seen, 0, PC);
+
+	return (opt_calls(header, header, seen)) ? -1 : size;
+}
+
+/*
+
+static int optimize_inline(void);
+
+Replace calls to small functions that aren't recursive with a copy of the
+function's body (see above), if their arguments are all simple (see
+opt_simple()). The body's parameters are replaced by the arguments, so
+there's no stack frame. Returns the number of calls replaced. If there were
+any, the program is rebuilt without the instructions that were removed (as
+with optimize_compact()).
+
+*/
+
+static int optimize_inline(void)
+{
+	llong *sizes, *newpc, *offset, pc, arg, header, nparams, size, body, target, n = 0, grow = 0, i;
+	instr_t *code;
+	char *seen, *final;
+	int inlined = 0;
+
+	if (!attr.inline_size)
+		return 0;
+
+	/* Find the functions that can be inlined (sizes: 0 = unchecked, -1 = no, else size + 1) */
+
+	sizes = malloc_or_fatalsys(PC * sizeof(llong));
+	memset(sizes, 0, PC * sizeof(llong));
+	seen = malloc_or_fatalsys(PC);
+
+	opt_stale = 1;
+	opt_count();
+
+	for (pc = 0; pc < PC; ++pc)
+	{
+		if (opt_dead[pc] || Program[pc].func != c_func)
+			continue;
+
+		header = Program[pc].value;
+
+		if (!sizes[header])
+			sizes[header] = opt_inlinable(header, seen) + 1;
+
+		if (sizes[header] <= 0)
+			continue;
+
+		/* The arguments must be simple, with no jumps between them */
+
+		nparams = Program[header].value;
+
+		for (i = 0, arg = pc; i < nparams && (arg = opt_prev(arg)) >= 0 && opt_simple(arg) && !opt_refs[opt_next(arg + 1)]; ++i)
+		{}
+
+		if (i != nparams)
+			continue;
+
+		grow += sizes[header] - 1 - (1 + nparams);
+		++inlined;
+	}
+
+	if (!inlined || PC + grow > MAX_PROGRAM_SIZE)
+	{
+		free(sizes);
+		free(seen);
+
+		return 0;
+	}
+
+	/* Rebuild the program with the function bodies at the call sites */
+
+	code = malloc_or_fatalsys((PC + grow + 1) * sizeof(instr_t));
+	final = malloc_or_fatalsys(PC + grow + 1);
+	memset(final, 0, PC + grow + 1);
+	newpc = malloc_or_fatalsys((PC + 1) * sizeof(llong));
+	offset = malloc_or_fatalsys((PC + 1) * sizeof(llong));
+
+	for (pc = 0; pc < PC; ++pc)
+	{
+		newpc[pc] = n;
+
+		if (opt_dead[pc])
+			continue;
+
+		header = (Program[pc].func == c_func) ? Program[pc].value : -1;
+
+		if (header == -1 || sizes[header] <= 0)
+		{
+			code[n++] = Program[pc];
+
+			continue;
+		}
+
+		/* Check the arguments again (as above) */
+
+		nparams = Program[header].value;
+
+		for (i = 0, arg = pc; i < nparams && (arg = opt_prev(arg)) >= 0 && opt_simple(arg) && !opt_refs[opt_next(arg + 1)]; ++i)
+		{}
+
+		if (i != nparams)
+		{
+			code[n++] = Program[pc];
+
+			continue;
+		}
+
+		debug(("inline %s() (%lld instructions) at %lld", opt_function_name(header), sizes[header] - 1, pc));
+
+		/* Replace the arguments (the last nparams instructions) with the body */
+
+		n -= nparams;
+
+		for (size = 0, body = opt_next(header + 1);; body = opt_next(body + 1))
+		{
+			offset[body - header] = size;
+
+			if (Program[body].func == c_return)
+				break;
+
+			++size;
+		}
+
+		for (body = opt_next(header + 1); Program[body].func != c_return; body = opt_next(body + 1))
+		{
+			if (Program[body].func == c_param)
+			{
+				for (i = 0, arg = pc; i < nparams - Program[body].value; ++i)
+					arg = opt_prev(arg);
+
+				code[n] = Program[arg];
+			}
+			else if (opt_jump(Program[body].func))
+			{
+				target = opt_target(body);
+				code[n].func = Program[body].func;
+				code[n].value = newpc[pc] - nparams + offset[target - header] - 1;
+				final[n] = 1;
+			}
+			else
+				code[n] = Program[body];
+
+			++n;
+		}
+	}
+
+	newpc[PC] = n;
+
+	/* Update the jumps and calls that weren't in inlined bodies */
+
+	for (i = 0; i < n; ++i)
+	{
+		if (final[i])
+			continue;
+
+		if (opt_jump(code[i].func))
+			code[i].value = newpc[opt_next(code[i].value + 1)] - 1;
+		else if (code[i].func == c_func)
+			code[i].value = newpc[code[i].value];
+	}
+
+	memcpy(Program, code, n * sizeof(instr_t));
+	opt_relocate_symbols(newpc);
+	startPC = newpc[opt_next(startPC)];
+	PC = n;
+
+	free(sizes);
+	free(seen);
+	free(code);
+	free(final);
+	free(newpc);
+	free(offset);
+
+	return inlined;
+}
+
+/*
+
+static void optimize_compact(void);
+
+Remove the instructions that have been marked as removed, and update the
+jumps, calls, and startPC accordingly.
+
+*/
+
+static void optimize_compact(void)
+{
+	llong *newpc, pc, n = 0;
+
+	newpc = malloc_or_fatalsys((PC + 1) * sizeof(llong));
+
+	for (pc = 0; pc <= PC; ++pc)
+	{
+		newpc[pc] = n;
+
+		if (pc < PC && !opt_dead[pc])
+			++n;
+	}
+
+	for (pc = 0; pc < PC; ++pc)
+	{
+		if (opt_dead[pc])
+			continue;
+
+		if (opt_jump(Program[pc].func))
+			Program[pc].value = newpc[opt_target(pc)] - 1;
+		else if (Program[pc].func == c_func)
+			Program[pc].value = newpc[Program[pc].value];
+	}
+
+	for (pc = 0; pc < PC; ++pc)
+		if (!opt_dead[pc])
+			Program[newpc[pc]] = Program[pc];
+
+	opt_relocate_symbols(newpc);
+	startPC = newpc[opt_next(startPC)];
+	PC = n;
+
+	free(newpc);
+}
+
+#ifndef NDEBUG
+/*
+
+static void debug_listing(const char *when);
+
+Output a listing of Program to stderr, if requested.
+
+*/
+
+static void debug_listing(const char *when)
+{
+	llong pc;
+
+	if (!(attr.debug_flags & DEBUG_OPTIMIZER))
+		return;
+
+	fprintf(stderr, "%s: %s: %lld instructions\n", "optimizer", when, PC);
+
+	for (pc = 0; pc < PC; ++pc)
+		fprintf(stderr, "%s: %c%lld %s %lld\n", "optimizer", (pc == startPC) ? '>' : ' ', pc, instruction_name(Program[pc].func), Program[pc].value);
+}
+#else
+#define debug_listing(when)
+#endif
+
+/*
+
+void rawhide_optimize(void);
+
+Optimize the program after it has been parsed (see above).
+
+*/
+
+void rawhide_optimize(void)
+{
+	int inlined;
+
+	if (startPC == -1)
+		return;
+
+	debug_listing("before");
+
+	do
+	{
+		opt_dead = malloc_or_fatalsys(PC);
+		memset(opt_dead, 0, PC);
+		opt_refs = malloc_or_fatalsys(PC * sizeof(llong));
+		opt_qrefs = malloc_or_fatalsys(PC * sizeof(llong));
+		opt_stale = 1;
+
+		while (optimize_unreachable() + optimize_peephole())
+		{}
+
+		if (!(inlined = optimize_inline()))
+			optimize_compact();
+
+		free(opt_dead);
+		free(opt_refs);
+		free(opt_qrefs);
+	}
+	while (inlined);
+
+	debug_listing("after");
+}
+
+/*
+
+The interpreter
+
+rawhide_execute() runs the program from startPC. The reference interpreter
+calls each instruction's function (the c_* functions in rhcmds.c) in turn.
+Where the compiler supports computed goto (GCC and Clang, unless built
+with -DNO_THREADED_CODE), a direct-threaded interpreter is used instead:
+rawhide_compile() gives each instruction an opcode, and the code for each
+opcode jumps straight to the code for the next instruction's opcode, with
+the program counter, stack pointer, and frame pointer in local variables
+rather than thread-local ones. The operators, control flow, function calls,
+and the most used stat(2) fields are implemented inline. Everything else
+calls its function as usual. The c_* functions remain the definition of
+what each instruction does. Setting RAWHIDE_TEST_REFERENCE_ENGINE selects
+them instead (for testing). make test uses the direct-threaded interpreter,
+make test-reference runs the whole test suite again with the reference
+one, and tests/t45 checks that both agree on a range of expressions.
+
+*/
+
+#if defined(__GNUC__) && !defined(NO_THREADED_CODE)
+#define HAVE_THREADED_CODE 1
+#endif
+
+enum
+{
+	OP_CALL,     /* Call the instruction's function */
+	OP_END,      /* The end of the program (NULL) */
+	OP_NUMBER, OP_PARAM,
+	OP_LE, OP_LT, OP_GE, OP_GT, OP_NE, OP_EQ,
+	OP_BITOR, OP_BITAND, OP_BITXOR, OP_LSHIFT, OP_RSHIFT,
+	OP_PLUS, OP_MINUS, OP_MUL, OP_DIV, OP_MOD,
+	OP_NOT, OP_BITNOT, OP_UNIMINUS,
+	OP_QM, OP_COLON, OP_JT, OP_JF, OP_BOOL, OP_COMMA, OP_FUNC, OP_RETURN,
+	OP_MODE, OP_UID, OP_GID, OP_MTIME, OP_DEPTH
+};
+
+typedef struct opcode_t opcode_t;
+struct opcode_t
+{
+	void (*func)(llong); /* The instruction */
+	int op;              /* Its opcode */
+};
+
+static opcode_t opcode_table[] =
+{
+	{ c_number, OP_NUMBER }, { c_param, OP_PARAM },
+	{ c_le, OP_LE }, { c_lt, OP_LT }, { c_ge, OP_GE }, { c_gt, OP_GT }, { c_ne, OP_NE }, { c_eq, OP_EQ },
+	{ c_bitor, OP_BITOR }, { c_bitand, OP_BITAND }, { c_bitxor, OP_BITXOR }, { c_lshift, OP_LSHIFT }, { c_rshift, OP_RSHIFT },
+	{ c_plus, OP_PLUS }, { c_minus, OP_MINUS }, { c_mul, OP_MUL }, { c_div, OP_DIV }, { c_mod, OP_MOD },
+	{ c_not, OP_NOT }, { c_bitnot, OP_BITNOT }, { c_uniminus, OP_UNIMINUS },
+	{ c_qm, OP_QM }, { c_colon, OP_COLON }, { c_jt, OP_JT }, { c_jf, OP_JF }, { c_bool, OP_BOOL }, { c_comma, OP_COMMA }, { c_func, OP_FUNC }, { c_return, OP_RETURN },
+	{ c_mode, OP_MODE }, { c_uid, OP_UID }, { c_gid, OP_GID }, { c_mtime, OP_MTIME }, { c_depth, OP_DEPTH },
+
+	{ NULL, 0 }
+};
+
+static int reference_engine; /* Use the reference interpreter? */
+
+/*
+
+void rawhide_compile(int reference);
+
+Prepare the program for rawhide_execute(), after it has been parsed, by
+giving each instruction its opcode for the direct-threaded interpreter.
+If reference is non-zero, rawhide_execute() uses the reference interpreter
+instead (for testing).
+
+*/
+
+void rawhide_compile(int reference)
+{
+	llong pc;
+	int i;
+
+	reference_engine = reference;
+
+	for (pc = 0; pc < PC; ++pc)
+	{
+		Program[pc].op = (Program[pc].func) ? OP_CALL : OP_END;
+
+		for (i = 0; Program[pc].func && opcode_table[i].func; ++i)
+		{
+			if (opcode_table[i].func == Program[pc].func)
+			{
+				Program[pc].op = opcode_table[i].op;
+				break;
+			}
+		}
+	}
+}
+
+#ifdef HAVE_THREADED_CODE
+/*
+
+static llong threaded_execute(void);
+
+Execute the program stored in Program with the direct-threaded
+interpreter (see above). Returns the value of the expression.
+
+*/
+
+static llong threaded_execute(void)
+{
+	static const void *labels[] =
+	{
+		__extension__ &&op_call, __extension__ &&op_end, __extension__ &&op_number, __extension__ &&op_param,
+		__extension__ &&op_le, __extension__ &&op_lt, __extension__ &&op_ge, __extension__ &&op_gt, __extension__ &&op_ne, __extension__ &&op_eq,
+		__extension__ &&op_bitor, __extension__ &&op_bitand, __extension__ &&op_bitxor, __extension__ &&op_lshift, __extension__ &&op_rshift,
+		__extension__ &&op_plus, __extension__ &&op_minus, __extension__ &&op_mul, __extension__ &&op_div, __extension__ &&op_mod,
+		__extension__ &&op_not, __extension__ &&op_bitnot, __extension__ &&op_uniminus,
+		__extension__ &&op_qm, __extension__ &&op_colon, __extension__ &&op_jt, __extension__ &&op_jf, __extension__ &&op_bool, __extension__ &&op_comma, __extension__ &&op_func, __extension__ &&op_return,
+		__extension__ &&op_mode, __extension__ &&op_uid, __extension__ &&op_gid, __extension__ &&op_mtime, __extension__ &&op_depth
+	};
+
+	llong *stack = Stack, sp = 0, fp = FP, pc = startPC;
+	instr_t *ip = &Program[pc];
+
+	#define DISPATCH() __extension__ ({ goto *labels[ip->op]; })
+	#define NEXT() __extension__ ({ ip = &Program[++pc]; goto *labels[ip->op]; })
+	#define PUSHED() if (sp >= MAX_STACK_SIZE) fatal("stack overflow")
+	#define BINARY(op) stack[sp - 2] = stack[sp - 2] op stack[sp - 1]; --sp; NEXT()
+
+	DISPATCH();
+
+	op_call:
+		SP = sp, PC = pc, FP = fp;
+		(*ip->func)(ip->value);
+		sp = SP, pc = PC, fp = FP;
+		PUSHED();
+		NEXT();
+
+	op_end:
+		SP = sp, PC = pc, FP = fp;
+		return stack[0];
+
+	op_number:   stack[sp++] = ip->value; PUSHED(); NEXT();
+	op_param:    stack[sp++] = stack[fp + ip->value]; PUSHED(); NEXT();
+
+	op_le:       BINARY(<=);
+	op_lt:       BINARY(<);
+	op_ge:       BINARY(>=);
+	op_gt:       BINARY(>);
+	op_ne:       BINARY(!=);
+	op_eq:       BINARY(==);
+	op_bitor:    BINARY(|);
+	op_bitand:   BINARY(&);
+	op_bitxor:   BINARY(^);
+	op_lshift:   BINARY(<<);
+	op_rshift:   BINARY(>>);
+	op_plus:     BINARY(+);
+	op_minus:    BINARY(-);
+	op_mul:      BINARY(*);
+	op_div:      if (stack[sp - 1] == 0) fatal("attempt to divide by zero"); BINARY(/);
+	op_mod:      if (stack[sp - 1] == 0) fatal("attempt to divide by zero"); BINARY(%);
+
+	op_not:      stack[sp - 1] = !stack[sp - 1]; NEXT();
+	op_bitnot:   stack[sp - 1] = ~stack[sp - 1]; NEXT();
+	op_uniminus: stack[sp - 1] = -stack[sp - 1]; NEXT();
+
+	op_qm:       pc = (stack[--sp]) ? pc : ip->value; NEXT();
+	op_colon:    pc = ip->value; NEXT();
+	op_jt:       if (stack[sp - 1]) stack[sp - 1] = 1, pc = ip->value; else --sp; NEXT();
+	op_jf:       if (stack[sp - 1]) --sp; else pc = ip->value; NEXT();
+	op_bool:     stack[sp - 1] = !!stack[sp - 1]; NEXT();
+	op_comma:    stack[sp - 2] = stack[sp - 1]; --sp; NEXT();
+
+	op_func:
+		stack[sp++] = pc;
+		stack[sp++] = fp;
+		pc = ip->value;
+		fp = sp - (Program[pc].value + 2);
+		PUSHED();
+		NEXT();
+
+	op_return:
+		pc = stack[sp - 3];
+		fp = stack[sp - 2];
+		stack[sp - (3 + ip->value)] = stack[sp - 1];
+		sp -= 2 + ip->value;
+		NEXT();
+
+	op_mode:     stack[sp++] = attr.statbuf->st_mode; PUSHED(); NEXT();
+	op_uid:      stack[sp++] = attr.statbuf->st_uid; PUSHED(); NEXT();
+	op_gid:      stack[sp++] = attr.statbuf->st_gid; PUSHED(); NEXT();
+	op_mtime:    stack[sp++] = MTIME(attr.statbuf); PUSHED(); NEXT();
+	op_depth:    stack[sp++] = attr.depth; PUSHED(); NEXT();
+
+	#undef DISPATCH
+	#undef NEXT
+	#undef PUSHED
+	#undef BINARY
+}
+#endif
+
+/*
+
+llong rawhide_execute(void);
+
+Execute the program stored in Program.
+Each element of Program contains a pointer to a function.
+The program is NULL-terminated.
+Returns the value of the expression.
+
+*/
+
+llong rawhide_execute(void)
+{
+	#ifdef HAVE_THREADED_CODE
+	if (!reference_engine)
+		return threaded_execute();
+	#endif
+
+	for (SP = 0, PC = startPC; Program[PC].func; PC++)
+	{
+		(*Program[PC].func)(Program[PC].value);
+
+		if (SP >= MAX_STACK_SIZE)
+			fatal("stack overflow");
+	}
+
+	return Stack[0];
+}
+
+/* What each instruction needs to know about the candidate (see rawhide_needs()) */
+
+typedef struct needs_t needs_t;
+struct needs_t
+{
+	void (*func)(llong); /* The instruction */
+	int needs;           /* NEED_* bits */
+};
+
+static needs_t needs_table[] =
+{
+	/* stat structure fields */
+
+	{ c_dev,     NEED_DEV },
+	{ c_major,   NEED_DEV },
+	{ c_minor,   NEED_DEV },
+	{ c_ino,     NEED_INO },
+	{ c_mode,    NEED_MODE },
+	{ c_nlink,   NEED_NLINK },
+	{ c_uid,     NEED_UID },
+	{ c_gid,     NEED_GID },
+	{ c_nouser,  NEED_UID },
+	{ c_nogroup, NEED_GID },
+	{ c_rdev,    NEED_DEV },
+	{ c_rmajor,  NEED_DEV },
+	{ c_rminor,  NEED_DEV },
+	{ c_size,    NEED_SIZE },
+	{ c_blksize, NEED_DEV },
+	{ c_blocks,  NEED_BLOCKS },
+	{ c_atime,   NEED_ATIME },
+	{ c_mtime,   NEED_MTIME },
+	{ c_ctime,   NEED_CTIME },
+	{ c_btime,   NEED_BTIME },
+
+	/* Filesystem types (from the device via the mount table) */
+
+	{ c_fstype,    NEED_DEV },
+	#ifdef FNM_CASEFOLD
+	{ c_ifstype,   NEED_DEV },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_refstype,  NEED_DEV },
+	{ c_reifstype, NEED_DEV },
+	#endif
+
+	/* Symlink targets (only need to know that it's a symlink) */
+
+	{ c_link,    NEED_TYPE },
+	{ c_ilink,   NEED_TYPE },
+	#ifdef HAVE_PCRE2
+	{ c_relink,  NEED_TYPE },
+	{ c_reilink, NEED_TYPE },
+	#endif
+	{ t_exists,  NEED_TYPE },
+	{ t_dev,     NEED_TYPE },
+	{ t_major,   NEED_TYPE },
+	{ t_minor,   NEED_TYPE },
+	{ t_ino,     NEED_TYPE },
+	{ t_mode,    NEED_TYPE },
+	{ t_nlink,   NEED_TYPE },
+	{ t_uid,     NEED_TYPE },
+	{ t_gid,     NEED_TYPE },
+	{ t_rdev,    NEED_TYPE },
+	{ t_rmajor,  NEED_TYPE },
+	{ t_rminor,  NEED_TYPE },
+	{ t_size,    NEED_TYPE },
+	{ t_blksize, NEED_TYPE },
+	{ t_blocks,  NEED_TYPE },
+	{ t_atime,   NEED_TYPE },
+	{ t_mtime,   NEED_TYPE },
+	{ t_ctime,   NEED_TYPE },
+	{ t_btime,   NEED_TYPE },
+	{ t_strlen,  NEED_TYPE },
+
+	/* Anything else that doesn't need stat(2) at all */
+
+	{ c_number, 0 }, { c_param, 0 }, { c_comma, 0 },
+	{ c_lt, 0 }, { c_le, 0 }, { c_gt, 0 }, { c_ge, 0 }, { c_eq, 0 }, { c_ne, 0 },
+	{ c_bitor, 0 }, { c_bitand, 0 }, { c_bitxor, 0 }, { c_lshift, 0 }, { c_rshift, 0 },
+	{ c_plus, 0 }, { c_minus, 0 }, { c_mul, 0 }, { c_div, 0 }, { c_mod, 0 },
+	{ c_not, 0 }, { c_bitnot, 0 }, { c_uniminus, 0 }, { c_bool, 0 },
+	{ c_depth, 0 }, { c_prune, 0 }, { c_trim, 0 }, { c_exit, 0 }, { c_strlen, 0 },
+	{ c_readable, 0 }, { c_writable, 0 }, { c_executable, 0 },
+	{ c_glob, 0 }, { c_path, 0 }, { c_i, 0 }, { c_ipath, 0 },
+	#ifdef HAVE_PCRE2
+	{ c_re, 0 }, { c_repath, 0 }, { c_rei, 0 }, { c_reipath, 0 },
+	#endif
+	{ c_sh, 0 }, { c_ush, 0 },
+
+	{ NULL, 0 }
+};
+
+/*
+
+static int instruction_needs(void (*func)(llong));
+
+Return what the given instruction needs to know about the candidate (NEED_*
+bits). Instructions that aren't known to be safe need everything (NEED_STAT).
+
+*/
+
+static int instruction_needs(void (*func)(llong))
+{
+	int i;
+
+	for (i = 0; needs_table[i].func; ++i)
+		if (needs_table[i].func == func)
+			return needs_table[i].needs;
+
+	/* Reference file fields don't need anything from the candidate */
+
+	for (i = 0; init_syms[i].name; ++i)
+		if (init_syms[i].type == REFFILE && init_syms[i].func == func)
+			return 0;
+
+	return NEED_STAT;
+}
+
+/*
+
+int rawhide_needs(void);
+
+Analyse the instructions in Program that are reachable from startPC to
+determine what the search criteria need to know about each candidate: only
+its path (NEED_PATH), or some stat(2) fields (other NEED_* bits). The file
+type is recognized as "mode & IFMT" (i.e., the type built-in in
+rawhide.conf).
+
+This is used to skip fstatat() for candidates whose directory entries
+contain their file type, and to request only the needed fields from
+statx() on Linux (see rawhide_stat()).
+
+*/
+
+int rawhide_needs(void)
+{
+	llong *todo, ntodo = 0, pc;
+	char *seen;
+	int needs = NEED_PATH;
+	void (*func)(llong);
+
+	if (startPC == -1)
+		return NEED_STAT;
+
+	seen = malloc_or_fatalsys(PC);
+	memset(seen, 0, PC);
+	todo = malloc_or_fatalsys(PC * sizeof(llong));
+	todo[ntodo++] = startPC;
+
+	while (ntodo)
+	{
+		for (pc = todo[--ntodo]; pc < PC && !seen[pc]; ++pc)
+		{
+			seen[pc] = 1;
+			func = Program[pc].func;
+
+			/* End of the expression or function */
+
+			if (!func || func == c_return)
+				break;
+
+			/* Branches and calls (the function's first instruction is after its header) */
+
+			if (func == c_qm || func == c_jt || func == c_jf || func == c_func)
+				todo[ntodo++] = Program[pc].value + 1;
+			else if (func == c_colon)
+				pc = Program[pc].value;
+
+			/* The file type (mode & IFMT) or the permissions as well */
+
+			else if (func == c_mode && pc + 2 < PC && Program[pc + 1].func == c_number && Program[pc + 1].value == S_IFMT && Program[pc + 2].func == c_bitand)
+				needs |= NEED_TYPE;
+
+			/* Anything else */
+
+			else
+				needs |= instruction_needs(func);
+		}
+	}
+
+	free(seen);
+	free(todo);
+
+	return needs;
+}
+
+/* What each instruction costs, roughly, and whether it has side effects, or can report errors (see rawhide_cost()) */
+
+typedef struct cost_t cost_t;
+struct cost_t
+{
+	void (*func)(llong); /* The instruction */
+	int cost;            /* Its relative cost (an operator is 1) */
+	int side_effects;    /* Does it take an action (or might it fail, or report an error)? */
+};
+
+static cost_t cost_table[] =
+{
+	/* Actions, and operators that can fail */
+
+	{ c_prune, 1, 1 }, { c_trim, 1, 1 }, { c_exit, 1, 1 },
+	{ c_sh, 100000, 1 }, { c_ush, 100000, 1 },
+	{ c_div, 1, 1 }, { c_mod, 1, 1 },
+
+	/* Patterns matched against the name or path (regular expressions can report matching errors) */
+
+	{ c_glob, 10, 0 }, { c_path, 10, 0 },
+	#ifdef FNM_CASEFOLD
+	{ c_i, 10, 0 }, { c_ipath, 10, 0 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_re, 20, 1 }, { c_rei, 20, 1 }, { c_repath, 20, 1 }, { c_reipath, 20, 1 },
+	#endif
+
+	/* System calls and lookups (reading symlinks, and reference files that don't exist, can report errors) */
+
+	{ c_btime, 10, 0 }, { c_strlen, 2, 0 },
+	{ c_nouser, 100, 0 }, { c_nogroup, 100, 0 },
+	{ c_readable, 100, 0 }, { c_writable, 100, 0 }, { c_executable, 100, 0 },
+	#if HAVE_ATTR || HAVE_FLAGS || HAVE_SOLARIS_ATTR
+	{ c_attr, 100, 0 },
+	#endif
+	#if HAVE_ATTR
+	{ c_proj, 100, 0 }, { c_gen, 100, 0 },
+	#endif
+	{ c_fstype, 20, 0 },
+	#ifdef FNM_CASEFOLD
+	{ c_ifstype, 20, 0 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_refstype, 30, 1 }, { c_reifstype, 30, 1 },
+	#endif
+	{ c_link, 100, 1 },
+	#ifdef FNM_CASEFOLD
+	{ c_ilink, 100, 1 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_relink, 100, 1 }, { c_reilink, 100, 1 },
+	#endif
+	{ t_exists, 100, 1 }, { t_dev, 100, 1 }, { t_major, 100, 1 }, { t_minor, 100, 1 }, { t_ino, 100, 1 },
+	{ t_mode, 100, 1 }, { t_nlink, 100, 1 }, { t_uid, 100, 1 }, { t_gid, 100, 1 }, { t_rdev, 100, 1 },
+	{ t_rmajor, 100, 1 }, { t_rminor, 100, 1 }, { t_size, 100, 1 }, { t_blksize, 100, 1 }, { t_blocks, 100, 1 },
+	{ t_atime, 100, 1 }, { t_mtime, 100, 1 }, { t_ctime, 100, 1 }, { t_btime, 100, 1 }, { t_strlen, 100, 1 },
+	{ r_dev, 1, 1 }, { r_major, 1, 1 }, { r_minor, 1, 1 }, { r_ino, 1, 1 }, { r_mode, 1, 1 },
+	{ r_nlink, 1, 1 }, { r_uid, 1, 1 }, { r_gid, 1, 1 }, { r_rdev, 1, 1 }, { r_rmajor, 1, 1 },
+	{ r_rminor, 1, 1 }, { r_size, 1, 1 }, { r_blksize, 1, 1 }, { r_blocks, 1, 1 }, { r_atime, 1, 1 },
+	{ r_mtime, 1, 1 }, { r_ctime, 1, 1 }, { r_btime, 10, 1 }, { r_type, 1, 1 }, { r_perm, 1, 1 },
+	#if HAVE_ATTR || HAVE_FLAGS || HAVE_SOLARIS_ATTR
+	{ r_attr, 100, 1 },
+	#endif
+	#if HAVE_ATTR
+	{ r_proj, 100, 1 }, { r_gen, 100, 1 },
+	#endif
+
+	/* ACLs and EAs */
+
+	#ifdef HAVE_ACL
+	{ c_acl, 1000, 1 },
+	#ifdef FNM_CASEFOLD
+	{ c_iacl, 1000, 1 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_reacl, 1000, 1 }, { c_reiacl, 1000, 1 },
+	#endif
+	#endif
+	#if defined(HAVE_POSIX_ACL) && defined(ACL_TYPE_DEFAULT)
+	{ c_dacl, 1000, 1 },
+	#ifdef FNM_CASEFOLD
+	{ c_idacl, 1000, 1 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_redacl, 1000, 1 }, { c_reidacl, 1000, 1 },
+	#endif
+	#endif
+	#ifdef HAVE_EA
+	{ c_ea, 1000, 1 },
+	#ifdef FNM_CASEFOLD
+	{ c_iea, 1000, 1 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_reea, 1000, 1 }, { c_reiea, 1000, 1 },
+	#endif
+	#endif
+
+	/* File contents and types (reading the file can report errors, but a file type is just unknown) */
+
+	{ c_body, 10000, 1 },
+	#ifdef FNM_CASEFOLD
+	{ c_ibody, 10000, 1 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_rebody, 10000, 1 }, { c_reibody, 10000, 1 },
+	#endif
+	#ifdef HAVE_MAGIC
+	{ c_what, 10000, 0 }, { c_mime, 10000, 0 },
+	#ifdef FNM_CASEFOLD
+	{ c_iwhat, 10000, 0 }, { c_imime, 10000, 0 },
+	#endif
+	#ifdef HAVE_PCRE2
+	{ c_rewhat, 10000, 1 }, { c_reiwhat, 10000, 1 }, { c_remime, 10000, 1 }, { c_reimime, 10000, 1 },
+	#endif
+	#endif
+
+	{ NULL, 0, 0 }
+};
+
+/*
+
+static llong function_cost(llong start, llong end, int *side_effects, int depth);
+
+Return the estimated cost of the instructions from start up to (but not
+including) end, or up to the end of the function that they're in, and set
+*side_effects if any of them take actions, might fail, or might report
+errors (including in the functions that they call, up to the given depth).
+
+*/
+
+static llong function_cost(llong start, llong end, int *side_effects, int depth)
+{
+	llong cost = 0, pc;
+	int i;
+
+	for (pc = start; pc < end && Program[pc].func && Program[pc].func != c_return; ++pc)
+	{
+		if (Program[pc].func == c_func)
+		{
+			if (depth > 8) /* Probably recursive */
+			{
+				*side_effects = 1;
+
+				return cost + 100000;
+			}
+
+			cost += 2 + function_cost(Program[pc].value + 1, PC, side_effects, depth + 1);
+
+			continue;
+		}
+
+		for (i = 0; cost_table[i].func && cost_table[i].func != Program[pc].func; ++i)
+		{}
+
+		cost += (cost_table[i].func) ? cost_table[i].cost : 1;
+
+		if (cost_table[i].side_effects)
+			*side_effects = 1;
+	}
+
+	return cost;
+}
+
+/*
+
+llong rawhide_cost(llong start, llong end, int *side_effects);
+
+Return the estimated cost of executing the instructions in Program from
+start up to (but not including) end, and set *side_effects to whether or
+not they might take an action (i.e., prune, trim, exit, .sh, or .ush),
+fail (i.e., divide by zero), or report an error (e.g., .body or .link). This
+is used to reorder the operands of the && and || operators so that cheaper
+ones are tried first, as long as none of them have side effects (see
+parse_chain() in rhparse.c), so that reordering never changes the output,
+error messages, or exit status.
+
+*/
+
+llong rawhide_cost(llong start, llong end, int *side_effects)
+{
+	*side_effects = 0;
+
+	return function_cost(start, end, side_effects, 0);
+}
+
+/*
+
+Automatic pruning with path patterns
+
+When the search criteria contain "pattern".path (or .ipath) tests, some
+directories can't possibly contain any matches (e.g., with
+"/srv/logs/2023-*.gz".path, anything under /srv/data). Before a
+directory is searched, the search criteria are evaluated with abstract
+values (false, true, or unknown) for everything that might be inside it.
+Path patterns are false if no path that starts with the directory's path
+(and a slash) could match them, and everything else that depends on the
+candidate is unknown. If the result is false, the directory is pruned.
+
+Note that "pattern".path treats slashes as ordinary characters, so a "*"
+can match any number of deeper path components. The literal text (and
+"?" and "[...]") before the first "*" constrain which directories (and
+which depths) can lead to a match, but nothing after it can.
+
+The directory isn't pruned if it would take any action, i.e. if the
+prune, trim, and exit built-ins, or the .sh and .ush pattern modifiers,
+(or a function that uses them) can be reached.
+
+*/
+
+#define PATH_FALSE 0   /* Known to be zero */
+#define PATH_TRUE 1    /* Known to be non-zero */
+#define PATH_UNKNOWN 2 /* Depends on the candidate */
+
+static char *path_impure;  /* For each function (by pc): 0 = unchecked, 1 = pure, 2 = impure */
+
+/*
+
+static int path_action(void (*func)(llong));
+
+Return whether or not the given instruction takes an action (that would be
+lost if the candidate's directory were pruned).
+
+*/
+
+static int path_action(void (*func)(llong))
+{
+	return func == c_prune || func == c_trim || func == c_exit || func == c_sh || func == c_ush;
+}
+
+/*
+
+static int path_function_impure(llong pc);
+
+Return whether or not the function whose header is at the given pc can
+take an action (including via the functions that it calls).
+
+*/
+
+static int path_function_impure(llong pc)
+{
+	llong i;
+
+	if (path_impure[pc])
+		return path_impure[pc] == 2;
+
+	path_impure[pc] = 1; /* Assume recursive calls are pure, until proven otherwise */
+
+	for (i = pc + 1; i < PC && Program[i].func && Program[i].func != c_return; ++i)
+	{
+		if (path_action(Program[i].func) || (Program[i].func == c_func && path_function_impure(Program[i].value)))
+		{
+			path_impure[pc] = 2;
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+
+int rawhide_path_pruning(void);
+
+Return whether or not the search criteria contain any path patterns
+(outside of functions) that might be used to prune directories (see
+rawhide_path_matchable()). Also check which functions take actions.
+
+*/
+
+int rawhide_path_pruning(void)
+{
+	int found = 0;
+	llong pc;
+
+	if (startPC == -1)
+		return 0;
+
+	path_impure = malloc_or_fatalsys(PC);
+	memset(path_impure, 0, PC);
+
+	for (pc = startPC; pc < PC && Program[pc].func; ++pc)
+	{
+		if (Program[pc].func == c_path || Program[pc].func == c_ipath)
+			found = 1;
+		else if (Program[pc].func == c_func)
+			path_function_impure(Program[pc].value);
+	}
+
+	return found;
+}
+
+/*
+
+static int path_prefix_matchable(const char *pattern, const char *prefix, int slash, int casefold);
+
+Return whether or not the given glob pattern (for FNM_EXTMATCH without
+FNM_PATHNAME) might match any path that starts with the given prefix (and
+a slash, if the slash parameter is set). This errs on the side of saying
+yes. Case is ignored (for ASCII characters) if casefold is set.
+
+*/
+
+static int path_prefix_matchable(const char *pattern, const char *prefix, int slash, int casefold)
+{
+	const char *p = pattern, *s = prefix, *q;
+	int c;
+
+	for (;;)
+	{
+		/* The next character of the prefix (and the slash) */
+
+		if (!(c = (unsigned char)*s) && slash)
+			c = '/';
+
+		if (!c)
+			return 1;
+
+		if (*s)
+			++s;
+		else
+			slash = 0;
+
+		/* The pattern has to match it */
+
+		switch (*p)
+		{
+			case '\0':
+				return 0;
+
+			case '*':
+				return 1;
+
+			case '?':
+			case '+':
+			case '@':
+			case '!':
+			{
+				if (p[1] == '(') /* Extended glob */
+					return 1;
+
+				if (*p != '?')
+					break;
+
+				if (c & 0x80) /* Might be multibyte */
+					return 1;
+
+				++p;
+
+				continue;
+			}
+
+			case '[':
+			{
+				/* Find the end of the bracket expression (any one character will do) */
+
+				q = p + 1;
+
+				if (*q == '!' || *q == '^')
+					++q;
+
+				if (*q == ']')
+					++q;
+
+				for (; *q && *q != ']'; ++q)
+				{
+					if (*q == '[' && (q[1] == ':' || q[1] == '=' || q[1] == '.'))
+					{
+						char delim = q[1];
+
+						for (q += 2; *q && !(*q == delim && q[1] == ']'); ++q)
+						{}
+
+						if (!*q)
+							return 1;
+
+						++q;
+					}
+					else if (*q == '\\' && q[1])
+						++q;
+				}
+
+				if (!*q || (c & 0x80))
+					return 1;
+
+				p = q + 1;
+
+				continue;
+			}
+
+			case '\\':
+			{
+				if (!p[1])
+					return 1;
+
+				++p;
+
+				break;
+			}
+		}
+
+		/* A literal character */
+
+		if (casefold)
+		{
+			if ((c & 0x80) || (*p & 0x80))
+				return 1;
+
+			if (tolower(c) != tolower((unsigned char)*p))
+				return 0;
+		}
+		else if (c != (unsigned char)*p)
+			return 0;
+
+		++p;
+	}
+}
+
+typedef struct path_branch_t path_branch_t;
+struct path_branch_t
+{
+	llong pc;            /* Where the branch goes */
+	llong sp;            /* Its stack pointer */
+	path_branch_t *next; /* The next pending branch */
+	char stack[];        /* Its abstract stack */
+};
+
+/*
+
+int rawhide_path_matchable(const char *fpath);
+
+Return whether or not anything inside the directory with the given path
+might match the search criteria (see rawhide_path_pruning()).
+
+*/
+
+int rawhide_path_matchable(const char *fpath)
+{
+	path_branch_t *branches = NULL, *branch, **bp;
+	size_t len = strlen(fpath);
+	int slash = (len && fpath[len - 1] != '/');
+	llong pc, sp = 0, stack_size = 0, i;
+	char *stack = NULL;
+	int live = 1, result = 1;
+	void (*func)(llong);
+
+	for (pc = startPC;; ++pc)
+	{
+		/* Merge any branches to here (the stack depths are always the same) */
+
+		for (bp = &branches; (branch = *bp);)
+		{
+			if (branch->pc != pc)
+			{
+				bp = &branch->next;
+
+				continue;
+			}
+
+			if (!live)
+			{
+				memcpy(stack, branch->stack, branch->sp);
+				sp = branch->sp;
+				live = 1;
+			}
+			else if (branch->sp != sp)
+				goto done;
+			else
+			{
+				for (i = 0; i < sp; ++i)
+					if (stack[i] != branch->stack[i])
+						stack[i] = PATH_UNKNOWN;
+			}
+
+			*bp = branch->next;
+			free(branch);
+		}
+
+		if (!(func = Program[pc].func))
+			break;
+
+		if (!live)
+			continue;
+
+		if (sp + 1 > stack_size)
+			stack = realloc_or_fatalsys(stack, stack_size = (stack_size) ? stack_size * 2 : 64);
+
+		/* Branches (to just after the given pc) */
+
+		if (func == c_qm || func == c_colon)
+		{
+			int cond = (func == c_qm) ? stack[--sp] : PATH_FALSE;
+
+			if (cond != PATH_TRUE)
+			{
+				branch = malloc_or_fatalsys(sizeof(path_branch_t) + sp + 1);
+				branch->pc = Program[pc].value + 1;
+				branch->sp = sp;
+				memcpy(branch->stack, stack, sp);
+				branch->next = branches;
+				branches = branch;
+			}
+
+			if (cond == PATH_FALSE)
+				live = 0;
+		}
+
+		/* Branches that keep their operand when they jump (non-zero for jt, zero for jf) */
+
+		else if (func == c_jt || func == c_jf)
+		{
+			int cond = stack[sp - 1], jump = (func == c_jt) ? PATH_TRUE : PATH_FALSE;
+
+			if (cond == jump || cond == PATH_UNKNOWN)
+			{
+				branch = malloc_or_fatalsys(sizeof(path_branch_t) + sp + 1);
+				branch->pc = Program[pc].value + 1;
+				branch->sp = sp;
+				memcpy(branch->stack, stack, sp);
+				branch->stack[sp - 1] = jump;
+				branch->next = branches;
+				branches = branch;
+			}
+
+			if (cond == jump)
+				live = 0;
+			else
+				--sp;
+		}
+
+		/* Path patterns */
+
+		else if (func == c_path || func == c_ipath)
+			stack[sp++] = path_prefix_matchable(&Strbuf[Program[pc].value], fpath, slash, func == c_ipath) ? PATH_UNKNOWN : PATH_FALSE;
+
+		/* Actions */
+
+		else if (path_action(func) || (func == c_func && path_impure[Program[pc].value] != 1))
+			goto done;
+
+		/* Everything else (by stack effect) */
+
+		else if (func == c_number)
+			stack[sp++] = (Program[pc].value) ? PATH_TRUE : PATH_FALSE;
+		else if (func == c_not)
+			stack[sp - 1] = (stack[sp - 1] == PATH_UNKNOWN) ? PATH_UNKNOWN : !stack[sp - 1];
+		else if (func == c_bool)
+			continue;
+		else if (func == c_comma)
+			stack[sp - 2] = stack[sp - 1], --sp;
+		else if (func == c_bitnot || func == c_uniminus)
+			stack[sp - 1] = PATH_UNKNOWN;
+		else if (func == c_func)
+			sp -= Program[Program[pc].value].value, stack[sp++] = PATH_UNKNOWN;
+		else if (func == c_lt || func == c_le || func == c_gt || func == c_ge || func == c_eq || func == c_ne ||
+			func == c_bitor || func == c_bitand || func == c_bitxor || func == c_lshift || func == c_rshift ||
+			func == c_plus || func == c_minus || func == c_mul || func == c_div || func == c_mod)
+			stack[sp - 2] = PATH_UNKNOWN, --sp;
+		else
+			stack[sp++] = PATH_UNKNOWN;
+	}
+
+	if (live && sp >= 1)
+		result = (stack[0] != PATH_FALSE);
+
+done:
+	while ((branch = branches))
+	{
+		branches = branch->next;
+		free(branch);
+	}
+
+	free(stack);
+
+	return result;
 }
 
 /* vi:set ts=4 sw=4: */
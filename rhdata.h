@@ -31,6 +31,12 @@ symbol_t *insert_symbol(char *name, int toktype, llong val);
 symbol_t *locate_symbol(char *name);
 symbol_t *locate_patmod_prefix(char *name);
 int rawhide_instruction(void (*func)(llong), llong value);
+llong rawhide_cost(llong start, llong end, int *side_effects);
+void rawhide_optimize(void);
+void rawhide_compile(int reference);
 llong rawhide_execute(void);
+int rawhide_needs(void);
+int rawhide_path_pruning(void);
+int rawhide_path_matchable(const char *fpath);
 
 #endif
@@ -44,7 +44,24 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <spawn.h>
+#include <pthread.h>
+
+#ifdef HAVE_GETDENTS64
+#include <stdint.h>
+#include <sys/syscall.h>
+#endif
+
+#ifdef HAVE_IO_URING
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
 
 #ifdef HAVE_ACL
 #include <sys/acl.h>
@@ -285,6 +302,208 @@ static int fcntl_set_fdflag(int fd, int flag)
 
 /*
 
+Directory streams
+
+On Linux, directory entries are read with getdents64(2) into a large
+buffer (RAWHIDE_GETDENTS_BUFSIZE bytes, default 256KiB), rather than with
+readdir(3), which uses a small buffer (32KiB with glibc). This means far
+fewer system calls for very large directories. Elsewhere, it's just
+fdopendir(3) and readdir(3).
+
+The buffers are reused (each thread keeps a free list of them), so only
+one buffer per level of open directories is ever allocated.
+
+*/
+
+#ifdef HAVE_GETDENTS64
+typedef struct linux_dirent64_t linux_dirent64_t;
+struct linux_dirent64_t
+{
+	uint64_t d_ino;           /* Inode number */
+	int64_t d_off;            /* Offset to the next entry */
+	unsigned short d_reclen;  /* Size of this entry */
+	unsigned char d_type;     /* File type */
+	char d_name[];            /* Nul-terminated file name */
+};
+
+static THREAD_LOCAL char *getdents_free; /* Free list of getdents64 buffers */
+#endif
+
+static void batch_free(rhbatch_t *batch);
+
+/*
+
+rhdir_t *rawhide_opendir(int dir_fd);
+
+Open a directory stream for the open directory file descriptor dir_fd
+(like fdopendir(3)). On success, returns the directory stream, which now
+owns dir_fd. On error, returns NULL with errno set by fdopendir(3), and
+dir_fd is still open.
+
+*/
+
+rhdir_t *rawhide_opendir(int dir_fd)
+{
+	rhdir_t *dir = malloc_or_fatalsys(sizeof(rhdir_t));
+
+	dir->fd = dir_fd;
+
+	dir->batch = NULL;
+
+	#ifdef HAVE_GETDENTS64
+	if ((dir->buf = getdents_free))
+		getdents_free = *(char **)dir->buf;
+	else
+		dir->buf = malloc_or_fatalsys(attr.getdents_bufsize);
+
+	dir->pos = dir->end = 0;
+	#else
+	if (!(dir->dir = fdopendir(dir_fd)))
+	{
+		free(dir);
+
+		return NULL;
+	}
+	#endif
+
+	return dir;
+}
+
+/*
+
+rhdirent_t *rawhide_readdir(rhdir_t *dir);
+
+Return the next entry in the directory stream dir, excluding "." and "..".
+The entry's name, inode number and file type (0 if not known)
+are valid until the next call. At the end of the directory (or on error),
+returns NULL. Also returns NULL if the stream has been closed by
+rawhide_suspenddir().
+
+*/
+
+rhdirent_t *rawhide_readdir(rhdir_t *dir)
+{
+	#ifdef HAVE_GETDENTS64
+	linux_dirent64_t *entry;
+	long n;
+
+	if (dir->fd == -1)
+		return NULL;
+
+	for (;;)
+	{
+		if (dir->pos >= dir->end)
+		{
+			if ((n = syscall(SYS_getdents64, dir->fd, dir->buf, attr.getdents_bufsize)) <= 0)
+				return NULL;
+
+			dir->pos = 0;
+			dir->end = n;
+		}
+
+		entry = (linux_dirent64_t *)(dir->buf + dir->pos);
+		dir->pos += entry->d_reclen;
+
+		if (entry->d_name[0] == '.' && (!entry->d_name[1] || (entry->d_name[1] == '.' && !entry->d_name[2])))
+			continue;
+
+		dir->entry->name = entry->d_name;
+		dir->entry->ino = (ino_t)entry->d_ino;
+		dir->entry->type = entry->d_type;
+
+		return dir->entry;
+	}
+	#else
+	struct dirent *entry;
+
+	if (dir->fd == -1)
+		return NULL;
+
+	while ((entry = readdir(dir->dir)))
+	{
+		if (entry->d_name[0] == '.' && (!entry->d_name[1] || (entry->d_name[1] == '.' && !entry->d_name[2])))
+			continue;
+
+		dir->entry->name = entry->d_name;
+		dir->entry->ino = entry->d_ino;
+		#ifdef DT_UNKNOWN
+		dir->entry->type = entry->d_type;
+		#else
+		dir->entry->type = 0;
+		#endif
+
+		return dir->entry;
+	}
+
+	return NULL;
+	#endif
+}
+
+/*
+
+static void rawhide_closedir_stream(rhdir_t *dir);
+
+Close the directory stream dir's underlying stream and file descriptor
+(if not already closed), but not dir itself or its batch.
+
+*/
+
+static void rawhide_closedir_stream(rhdir_t *dir)
+{
+	if (dir->fd == -1)
+		return;
+
+	#ifdef HAVE_GETDENTS64
+	*(char **)dir->buf = getdents_free;
+	getdents_free = dir->buf;
+	dir->buf = NULL;
+	close(dir->fd);
+	#else
+	closedir(dir->dir);
+	dir->dir = NULL;
+	#endif
+
+	dir->fd = -1;
+}
+
+/*
+
+void rawhide_closedir(rhdir_t *dir);
+
+Close the directory stream dir, and its file descriptor.
+
+*/
+
+void rawhide_closedir(rhdir_t *dir)
+{
+	batch_free(dir->batch);
+	rawhide_closedir_stream(dir);
+	free(dir);
+}
+
+/*
+
+static void getdents_buffers_free(void);
+
+Deallocate this thread's reusable getdents64 buffers.
+
+*/
+
+static void getdents_buffers_free(void)
+{
+	#ifdef HAVE_GETDENTS64
+	char *buf;
+
+	while ((buf = getdents_free))
+	{
+		getdents_free = *(char **)buf;
+		free(buf);
+	}
+	#endif
+}
+
+/*
+
 static ssize_t wcoffset(const char *str);
 
 When a string contains multi-byte UTF-8-encoded characters,
@@ -299,8 +518,8 @@ To deallocate it when finished, call with a NULL argument.
 
 static ssize_t wcoffset(const char *str)
 {
-	static wchar_t *wcs = NULL;
-	static size_t wcssize = 0;
+	static THREAD_LOCAL wchar_t *wcs = NULL;
+	static THREAD_LOCAL size_t wcssize = 0;
 
 	ssize_t num_wchars;
 	size_t num_bytes;
@@ -446,338 +665,6052 @@ static size_t cwtol(int length_char_widths, const char *str)
 	return (size_t)(s - str);
 }
 
+#if HAVE_STATX_BTIME
 /*
 
-static void rawhide_traverse(size_t nul_posi, int parent_fd, char *basename);
-
-Traverse the directory tree, evaluating search criteria, and calling the
-visit function, for each match.
-
-The nul_posi parameter is the offset to the nul byte at the end of attr.fpath.
-There can be a trailing "/" before nul_posi (but usually not).
-
-The parent_fd parameter is a file descriptor for the current entry's parent
-directory.
-
-The basename parameter points to the current entry's base name (often with a
-trailing "/") within attr.fpath.
+static unsigned int statx_mask(int needs);
 
-The parent_fd and basename parameters are used with openat() to minimize
-race conditions. When called by rawhide_search() they are AT_FDCWD and NULL.
+Return the statx() mask for the given NEED_* bits. The file type and
+inode number are always needed (for descending and cycle detection).
+The device and blksize are always returned by statx().
 
 */
 
-static int rawhide_traverse(size_t nul_posi, int parent_fd, char *basename)
+static unsigned int statx_mask(int needs)
 {
-	int dir_fd;
-	DIR *dir = NULL;
-	struct dirent *entry;
-	size_t remaining, post_slash_nul_posi, len;
-	struct stat save_statbuf[1];
-	int save_followed = 0;
-	int rc = 0, i;
-	char *name;
+	unsigned int mask = STATX_TYPE | STATX_INO;
+
+	if (needs & NEED_MODE)
+		mask |= STATX_MODE;
+	if (needs & NEED_NLINK)
+		mask |= STATX_NLINK;
+	if (needs & NEED_UID)
+		mask |= STATX_UID;
+	if (needs & NEED_GID)
+		mask |= STATX_GID;
+	if (needs & NEED_ATIME)
+		mask |= STATX_ATIME;
+	if (needs & NEED_MTIME)
+		mask |= STATX_MTIME;
+	if (needs & NEED_CTIME)
+		mask |= STATX_CTIME;
+	if (needs & NEED_SIZE)
+		mask |= STATX_SIZE;
+	if (needs & NEED_BLOCKS)
+		mask |= STATX_BLOCKS;
+	if (needs & NEED_BTIME)
+		mask |= STATX_BTIME;
+
+	return mask;
+}
 
-	debug(("rawhide_traverse(fpath=%s, offset=%d, parent_fd=%d, basename=%s, depth=%d)", attr.fpath, (int)nul_posi, parent_fd, (basename) ? basename : "N/A", attr.depth));
+/*
 
-	/* Check the depth (Can't happen: depth <= max_depth always) */
+static void statx_statbuf(struct statx *statxbuf, int needs);
 
-	if (attr.depth > attr.max_depth)
-	{
-		/* If we've reached the system limit that's an error */
+Fill in attr.statbuf (and the birth/created time if needed) from the
+statx() result, statxbuf, which was requested with statx_mask(needs).
 
-		if (attr.depth > attr.depth_limit)
-			return error("too many directory levels: %s", ok(attr.fpath));
+*/
 
-		return 0;
+static void statx_statbuf(struct statx *statxbuf, int needs)
+{
+	memset(attr.statbuf, 0, sizeof(struct stat));
+	attr.statbuf->st_dev = makedev(statxbuf->stx_dev_major, statxbuf->stx_dev_minor);
+	attr.statbuf->st_ino = statxbuf->stx_ino;
+	attr.statbuf->st_mode = statxbuf->stx_mode;
+	attr.statbuf->st_nlink = statxbuf->stx_nlink;
+	attr.statbuf->st_uid = statxbuf->stx_uid;
+	attr.statbuf->st_gid = statxbuf->stx_gid;
+	attr.statbuf->st_rdev = makedev(statxbuf->stx_rdev_major, statxbuf->stx_rdev_minor);
+	attr.statbuf->st_size = statxbuf->stx_size;
+	attr.statbuf->st_blksize = statxbuf->stx_blksize;
+	attr.statbuf->st_blocks = statxbuf->stx_blocks;
+	attr.statbuf->st_atim.tv_sec = statxbuf->stx_atime.tv_sec;
+	attr.statbuf->st_atim.tv_nsec = statxbuf->stx_atime.tv_nsec;
+	attr.statbuf->st_mtim.tv_sec = statxbuf->stx_mtime.tv_sec;
+	attr.statbuf->st_mtim.tv_nsec = statxbuf->stx_mtime.tv_nsec;
+	attr.statbuf->st_ctim.tv_sec = statxbuf->stx_ctime.tv_sec;
+	attr.statbuf->st_ctim.tv_nsec = statxbuf->stx_ctime.tv_nsec;
+
+	if (needs & NEED_BTIME)
+	{
+		attr.statx_btime_ok = (statxbuf->stx_mask & STATX_BTIME) != 0;
+		attr.statx_btime->tv_sec = statxbuf->stx_btime.tv_sec;
+		attr.statx_btime->tv_nsec = statxbuf->stx_btime.tv_nsec;
 	}
 
-	/* Prepare for this entry (fstatat) */
+	attr.stat_done = needs | NEED_TYPE | NEED_INO | NEED_DEV;
+}
+#endif
 
-	name = (parent_fd == AT_FDCWD) ? attr.fpath : basename;
+/*
 
-	debug(("fstatat(parent_fd=%d, path=%s)", parent_fd, name));
+static int stat_elidable(int type);
 
-	if (attr.test_fstatat_failure && !strcmp(attr.test_fstatat_failure, attr.fpath))
-		errno = EPERM;
+Return whether or not rawhide_stat() can skip stat(2) for a directory
+entry of the given type (DT_*) at the current depth (see rawhide_needs()).
 
-	if ((attr.test_fstatat_failure && !strcmp(attr.test_fstatat_failure, attr.fpath)) || fstatat(parent_fd, name, attr.statbuf, AT_SYMLINK_NOFOLLOW) == -1)
-		return errorsys("fstatat %s", ok(attr.fpath));
+*/
 
-	debug(("fstatat: basename %s type %o perm %o uid %d gid %d size %d", (basename) ? basename : "N/A", attr.statbuf->st_mode & S_IFMT, attr.statbuf->st_mode & ~S_IFMT, attr.statbuf->st_uid, attr.statbuf->st_gid, attr.statbuf->st_size));
-	attr.followed = 0;
+static int stat_elidable(int type)
+{
+	#ifdef DTTOIF
+	return !(attr.needs & ~NEED_TYPE) && type != DT_UNKNOWN && type != DT_DIR && !(type == DT_LNK && following_symlinks());
+	#else
+	return 0;
+	#endif
+}
 
-	/* Follow symlinks if requested. Overwrite attr.statbuf on success. */
-	/* On failure, continue with the symlink's statbuf, like find(1). */
+/*
 
-	if (islink(attr.statbuf) && following_symlinks())
-	{
-		if (fstatat(parent_fd, name, attr.statbuf, 0) == -1 && attr.report_broken_symlinks)
-		{
-			errorsys("fstatat %s (following symlink)", ok(attr.fpath));
-			attr.exit_status = EXIT_FAILURE;
-		}
+Batches of directory entries (-O option and RAWHIDE_IO_URING).
 
-		debug(("fstatat: basename %s type %o perm %o uid %d gid %d size %d", (basename) ? basename : "N/A", attr.statbuf->st_mode & S_IFMT, attr.statbuf->st_mode & ~S_IFMT, attr.statbuf->st_uid, attr.statbuf->st_gid, attr.statbuf->st_size));
-		attr.followed = 1;
-	}
+rawhide_readdir_batch() reads a batch of directory entries at a time (the
+whole directory with the -O option), and can fetch the stat(2) information
+that rawhide_stat() will need for them before returning them one at a
+time. rawhide_stat() then uses the fetched result for the current entry
+instead of making its own system call.
 
-	/* Test this entry and respond (if not searching depth-first) */
+With the -O option, the entries are sorted by inode number, and searched
+in that order. With -OO, they are statted in inode number order, and then
+searched in directory order. On rotational disks (and some networked
+filesystems), this avoids seeking back and forth across the inode table.
 
-	if (!attr.depth_first)
-	{
-		caches_init();
-		attr.parent_fd = parent_fd;
-		attr.basename = basename;
+With the -k option, the whole directory is read, and the entries are
+sorted by name, and searched in that order (see checkpoint_write()).
 
-		if (rawhide_execute() && !attr.pruned)
-			if (attr.depth >= attr.min_depth)
-				(*(attr.visitf))();
+With io_uring on Linux (RAWHIDE_IO_URING), a statx() request for each
+entry is submitted at once, which lets high-latency storage work on many
+requests in parallel. Each thread has its own ring. If io_uring isn't
+available (e.g., an old kernel, or it's disabled by a seccomp policy),
+or it doesn't support IORING_OP_STATX, this quietly falls back to
+synchronous statx() calls.
 
-		caches_done();
+*/
 
-		if (attr.exit)
-			exit(attr.exit_status);
-	}
-	else
-	{
-		*save_statbuf = *attr.statbuf;
-		save_followed = attr.followed;
-	}
+typedef struct batchent_t batchent_t;
+struct batchent_t
+{
+	size_t namei;                /* Offset of the entry's name in the batch's names */
+	ino_t ino;                   /* The entry's inode number */
+	int type;                    /* The entry's file type (DT_*) */
+	int seq;                     /* The entry's position in directory order */
+};
+
+typedef struct batchstat_t batchstat_t;
+struct batchstat_t
+{
+	int done;                    /* Was it statted? */
+	int res;                     /* The result (0 or -errno) */
+	#if HAVE_STATX_BTIME
+	struct statx statxbuf[1];    /* The statx() information */
+	#else
+	struct stat statbuf[1];      /* The fstatat() information */
+	#endif
+};
 
-	/* Record the filesystem device number at the start, for single-filesystem traversal */
+struct rhbatch_t
+{
+	int size;                    /* Maximum number of entries (or 0 for the whole directory) */
+	int n;                       /* Number of entries read */
+	int next;                    /* Index of the next entry to return */
+	int alloc;                   /* Number of entries allocated */
+	batchent_t *ent;             /* The entries */
+	batchstat_t *stat;           /* The entries' stat information (if fetched) */
+	int *order;                  /* The entries' indexes in directory order (for -OO) */
+	char *names;                 /* The entries' names */
+	size_t names_len;            /* Length of the names */
+	size_t names_size;           /* Size of the names buffer */
+	rhdirent_t entry[1];         /* The current entry */
+};
+
+static THREAD_LOCAL batchstat_t *batch_fetched; /* The current entry's stat information */
+
+static int ignore_isdir(int type);
+static int ignored(const char *name, int dir);
 
-	if (attr.single_filesystem && parent_fd == AT_FDCWD)
-		attr.fs_dev = attr.statbuf->st_dev;
+/*
 
-	/* If it's a directory, process its entries */
+static int batch_unneeded(rhbatch_t *batch, int i);
 
-	if (isdir(attr.statbuf) && attr.depth < attr.max_depth && !attr.prune && (!attr.single_filesystem || attr.statbuf->st_dev == attr.fs_dev))
-	{
-		/* Not too deep */
+Return whether or not rawhide_stat() won't need the stat(2) information of
+the entry with the given index in batch: either it isn't needed at all
+(see stat_elidable()), or the entry is ignored (for -G), and whether or not
+it's a directory doesn't make a difference (see rawhide_traverse()).
 
-		if (attr.depth == attr.depth_limit)
-			return error("too many directory levels: %s", ok(attr.fpath));
+*/
 
-		/* Check for filesystem cycles (symlinks, or even hard links on OpenVMS or macOS Time Machine backups) */
+static int batch_unneeded(rhbatch_t *batch, int i)
+{
+	if (stat_elidable(batch->ent[i].type))
+		return 1;
 
-		for (i = 0; i < attr.depth; ++i)
-		{
-			debug(("check search stack[%d] %d/%d looking for %d/%d", i, attr.search_stack[i].dev, attr.search_stack[i].ino, attr.statbuf->st_dev, attr.statbuf->st_ino));
+	return ignored(batch->names + batch->ent[i].namei, ignore_isdir(batch->ent[i].type)) == 1;
+}
 
-			if (attr.search_stack[i].dev == attr.statbuf->st_dev && attr.search_stack[i].ino == attr.statbuf->st_ino)
-			{
-				if (attr.report_cycles)
-					error("skipping %s: Filesystem cycle detected", ok(attr.fpath));
+#if HAVE_STATX_BTIME
+static THREAD_LOCAL int statx_unavailable; /* Did statx() fail with ENOSYS? */
+#endif
 
-				return 0; /* This is not an error */
-			}
-		}
+#ifdef HAVE_IO_URING
+typedef struct uring_t uring_t;
+struct uring_t
+{
+	int fd;                      /* The ring's file descriptor */
+	unsigned int entries;        /* Number of submission queue entries */
+	void *sq_ring;               /* Submission queue ring mapping */
+	size_t sq_ring_size;         /* Size of the submission queue ring mapping */
+	void *cq_ring;               /* Completion queue ring mapping (maybe the same as sq_ring) */
+	size_t cq_ring_size;         /* Size of the completion queue ring mapping */
+	struct io_uring_sqe *sqes;   /* Submission queue entries */
+	size_t sqes_size;            /* Size of the submission queue entries mapping */
+	unsigned int *sq_tail;       /* Submission queue tail (written by us) */
+	unsigned int *sq_mask;       /* Submission queue index mask */
+	unsigned int *sq_array;      /* Submission queue indirection array */
+	unsigned int *cq_head;       /* Completion queue head (written by us) */
+	unsigned int *cq_tail;       /* Completion queue tail (written by the kernel) */
+	unsigned int *cq_mask;       /* Completion queue index mask */
+	struct io_uring_cqe *cqes;   /* Completion queue entries */
+};
+
+static THREAD_LOCAL uring_t *uring;          /* This thread's ring */
+static THREAD_LOCAL int uring_unavailable;   /* Did io_uring fail? */
 
-		/* Open the directory as a file descriptor to minimize race conditions */
+/*
 
-		debug(("openat(parent_fd=%d, path=%s)", parent_fd, name));
+static int uring_init(void);
 
-		if (attr.test_openat_failure)
-			errno = EPERM;
+Create this thread's io_uring ring (if not already created) with room
+for attr.io_uring requests. On success, returns 0. On error, returns -1
+and io_uring won't be tried again by this thread.
 
-		if (attr.test_openat_failure || (dir_fd = openat(parent_fd, name, O_RDONLY)) == -1)
-			return errorsys("%s", ok(attr.fpath));
+*/
 
-		debug(("openat: dir_fd %d", dir_fd));
+static int uring_init(void)
+{
+	struct io_uring_params p[1];
+	uring_t *u;
+	int fd;
 
-		/* Prevent leaking this file descriptor into child processes */
+	if (uring)
+		return 0;
 
-		fcntl_set_fdflag(dir_fd, FD_CLOEXEC);
+	if (uring_unavailable)
+		return -1;
 
-		/* Open the directory as a DIR to enumerate its entries */
+	memset(p, 0, sizeof(struct io_uring_params));
 
-		debug(("fdopendir(dir_fd=%d)", dir_fd));
+	if ((fd = syscall(SYS_io_uring_setup, (unsigned int)attr.io_uring, p)) == -1)
+	{
+		debug(("io_uring_setup failed: %s (using synchronous statx)", strerror(errno)));
+		uring_unavailable = 1;
 
-		if (attr.test_fdopendir_failure)
-			errno = EPERM;
+		return -1;
+	}
 
-		if (attr.test_fdopendir_failure || !(dir = fdopendir(dir_fd)))
-		{
-			close(dir_fd);
+	fcntl_set_fdflag(fd, FD_CLOEXEC);
 
-			return errorsys("fdopendir %s", ok(attr.fpath));
-		}
+	u = malloc_or_fatalsys(sizeof(uring_t));
+	u->fd = fd;
+	u->entries = p->sq_entries;
+	u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
 
-		/* Ensure that there's a trailing "/" */
+	if (p->features & IORING_FEAT_SINGLE_MMAP && u->cq_ring_size > u->sq_ring_size)
+		u->sq_ring_size = u->cq_ring_size;
 
-		post_slash_nul_posi = nul_posi;
+	u->cq_ring = u->sqes = MAP_FAILED;
 
-		if (attr.fpath[post_slash_nul_posi - 1] != '/')
-		{
-			if (post_slash_nul_posi + 1 >= attr.fpath_size)
-			{
-				/* This shouldn't happen (unless we've crossed a filesystem boundary) */
+	if ((u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING)) == MAP_FAILED ||
+		(u->cq_ring = (p->features & IORING_FEAT_SINGLE_MMAP) ? u->sq_ring : mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING)) == MAP_FAILED ||
+		(u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES)) == MAP_FAILED)
+	{
+		debug(("io_uring mmap failed: %s (using synchronous statx)", strerror(errno)));
 
-				attr.fpath = realloc_or_fatalsys(attr.fpath, attr.fpath_size *= 2);
-			}
+		if (u->sq_ring != MAP_FAILED)
+			munmap(u->sq_ring, u->sq_ring_size);
+		if (u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+			munmap(u->cq_ring, u->cq_ring_size);
 
-			attr.fpath[post_slash_nul_posi++] = '/';
-			attr.fpath[post_slash_nul_posi] = '\0';
-		}
+		close(fd);
+		free(u);
+		uring_unavailable = 1;
 
-		remaining = attr.fpath_size - post_slash_nul_posi;
+		return -1;
+	}
 
-		/* Descend into the directory */
+	u->sq_tail = (unsigned int *)((char *)u->sq_ring + p->sq_off.tail);
+	u->sq_mask = (unsigned int *)((char *)u->sq_ring + p->sq_off.ring_mask);
+	u->sq_array = (unsigned int *)((char *)u->sq_ring + p->sq_off.array);
+	u->cq_head = (unsigned int *)((char *)u->cq_ring + p->cq_off.head);
+	u->cq_tail = (unsigned int *)((char *)u->cq_ring + p->cq_off.tail);
+	u->cq_mask = (unsigned int *)((char *)u->cq_ring + p->cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p->cq_off.cqes);
 
-		attr.search_stack[attr.depth].dev = attr.statbuf->st_dev;
-		attr.search_stack[attr.depth].ino = attr.statbuf->st_ino;
-		attr.depth += 1;
+	debug(("io_uring_setup: fd %d entries %u", fd, u->entries));
+	uring = u;
 
-		/* Apply recursively to this directory's entries */
+	return 0;
+}
 
-		while ((entry = readdir(dir)))
-		{
-			if (entry->d_name[0] == '.' && (!entry->d_name[1] || (entry->d_name[1] == '.' && !entry->d_name[2])))
-				continue;
+/*
 
-			if ((len = strlcpy(attr.fpath + post_slash_nul_posi, entry->d_name, remaining)) >= remaining)
-			{
-				/* This shouldn't happen (unless we've crossed a filesystem boundary) */
-
-				#define max(a, b) ((a) > (b) ? (a) : (b))
-				size_t new_fpath_size = max(attr.fpath_size * 2, post_slash_nul_posi + len + 1);
-				#undef max
-				attr.fpath = realloc_or_fatalsys(attr.fpath, new_fpath_size);
-				attr.fpath_size = new_fpath_size;
-				remaining = attr.fpath_size - post_slash_nul_posi;
-				strlcpy(attr.fpath + post_slash_nul_posi, entry->d_name, remaining);
-			}
+static void uring_free(void);
 
-			debug(("dir entry %s", attr.fpath));
+Deallocate this thread's io_uring ring.
 
-			if (rawhide_traverse(post_slash_nul_posi + len, (dir_fd == -1) ? AT_FDCWD : dir_fd, attr.fpath + post_slash_nul_posi) == -1)
-				rc = -1;
-		}
+*/
 
-		closedir(dir);
+static void uring_free(void)
+{
+	if (!uring)
+		return;
 
-		/* Ascend from the directory */
+	munmap(uring->sqes, uring->sqes_size);
+	if (uring->cq_ring != uring->sq_ring)
+		munmap(uring->cq_ring, uring->cq_ring_size);
+	munmap(uring->sq_ring, uring->sq_ring_size);
+	close(uring->fd);
+	free(uring);
+	uring = NULL;
+}
 
-		attr.depth -= 1;
+/*
 
-		/* Remove the trailing slash and directory entry name */
+static void uring_statx(int dir_fd, rhbatch_t *batch);
 
-		attr.fpath[nul_posi] = '\0';
-	}
+Submit a statx() request (relative to dir_fd) for each of the entries in
+batch that rawhide_stat() will need (in batch order, as many at once as
+the ring allows), and wait for them to complete. If IORING_OP_STATX isn't
+supported, the entries are left as not done, and io_uring won't be tried
+again by this thread.
 
-	/* Test this entry and respond (if searching depth-first) */
+*/
 
-	if (attr.depth_first)
+static void uring_statx(int dir_fd, rhbatch_t *batch)
+{
+	unsigned int mask = statx_mask(attr.needs);
+	unsigned int tail, head;
+	int submitted, completed, to_submit, rc, i = 0;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	batchstat_t *st;
+
+	while (i < batch->n && !uring_unavailable)
 	{
-		caches_init();
-		attr.parent_fd = parent_fd;
-		attr.basename = basename;
-		*attr.statbuf = *save_statbuf;
-		attr.followed = save_followed;
+		for (tail = *uring->sq_tail, submitted = 0; i < batch->n && submitted < (int)uring->entries; ++i)
+		{
+			if (batch_unneeded(batch, i))
+				continue;
 
-		if (rawhide_execute() && !attr.pruned)
-			if (attr.depth >= attr.min_depth)
-				(*(attr.visitf))();
+			sqe = &uring->sqes[tail & *uring->sq_mask];
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dir_fd;
+			sqe->addr = (uintptr_t)(batch->names + batch->ent[i].namei);
+			sqe->len = mask;
+			sqe->off = (uintptr_t)batch->stat[i].statxbuf;
+			sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+			sqe->user_data = i;
+			uring->sq_array[tail & *uring->sq_mask] = tail & *uring->sq_mask;
+			++tail;
+			++submitted;
+		}
 
-		caches_done();
+		__atomic_store_n(uring->sq_tail, tail, __ATOMIC_RELEASE);
 
-		if (attr.exit)
-			exit(attr.exit_status);
-	}
+		for (to_submit = submitted, completed = 0; completed < submitted;)
+		{
+			if ((rc = syscall(SYS_io_uring_enter, uring->fd, to_submit, submitted - completed, IORING_ENTER_GETEVENTS, NULL, 0)) == -1)
+			{
+				if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+					continue;
 
-	/* Don't prune siblings */
+				fatalsys("io_uring_enter");
+			}
 
-	attr.prune = 0;
+			to_submit -= rc;
 
-	return rc;
-}
+			for (head = *uring->cq_head; head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE); ++head, ++completed)
+			{
+				cqe = &uring->cqes[head & *uring->cq_mask];
+				st = &batch->stat[cqe->user_data];
+				st->res = cqe->res;
+				st->done = 1;
+
+				/* Older kernels reject unknown opcodes with EINVAL */
+
+				if (cqe->res == -EINVAL)
+				{
+					debug(("io_uring statx failed: %s (using synchronous statx)", strerror(EINVAL)));
+					st->done = 0;
+					uring_unavailable = 1;
+				}
+			}
+
+			__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+		}
+
+		debug(("io_uring statx: %d requests", submitted));
+	}
+}
+#endif
+
+/*
+
+static void batch_stat(int dir_fd, rhbatch_t *batch);
+
+Fetch the stat(2) information that rawhide_stat() will need for the
+entries in batch (relative to dir_fd), in batch order. This uses io_uring
+when enabled. Otherwise, it's only needed for -OO (with -O, each entry is
+statted in inode order anyway when it is searched).
+
+*/
+
+static void batch_stat(int dir_fd, rhbatch_t *batch)
+{
+	batchstat_t *st;
+	int i;
+
+	#ifdef HAVE_IO_URING
+	if (attr.io_uring && uring_init() != -1)
+		uring_statx(dir_fd, batch);
+	#endif
+
+	if (attr.inode_order < 2)
+		return;
+
+	for (i = 0; i < batch->n; ++i)
+	{
+		st = &batch->stat[i];
+
+		if (st->done || batch_unneeded(batch, i))
+			continue;
+
+		#if HAVE_STATX_BTIME
+		if (statx_unavailable)
+			break;
+
+		if (statx(dir_fd, batch->names + batch->ent[i].namei, AT_SYMLINK_NOFOLLOW, statx_mask(attr.needs), st->statxbuf) == -1)
+		{
+			if (errno == ENOSYS)
+			{
+				statx_unavailable = 1;
+				break;
+			}
+
+			st->res = -errno;
+		}
+		else
+			st->res = 0;
+		#else
+		st->res = (fstatat(dir_fd, batch->names + batch->ent[i].namei, st->statbuf, AT_SYMLINK_NOFOLLOW) == -1) ? -errno : 0;
+		#endif
+
+		st->done = 1;
+	}
+}
+
+/*
+
+static int batch_inode_cmp(const void *a, const void *b);
+
+Compare directory entries by inode number (for qsort()).
+
+*/
+
+static int batch_inode_cmp(const void *a, const void *b)
+{
+	const batchent_t *ea = a, *eb = b;
+
+	return (ea->ino < eb->ino) ? -1 : (ea->ino > eb->ino) ? 1 : 0;
+}
+
+/*
+
+static int batch_name_cmp(const void *a, const void *b);
+
+Compare directory entries by name (for qsort(), with batch_names set to the
+batch's names).
+
+*/
+
+static THREAD_LOCAL const char *batch_names; /* The names of the batch being sorted by name */
+
+static int batch_name_cmp(const void *a, const void *b)
+{
+	const batchent_t *ea = a, *eb = b;
+
+	return strcmp(batch_names + ea->namei, batch_names + eb->namei);
+}
+
+/*
+
+static void batch_add(rhbatch_t *batch, rhdirent_t *entry);
+
+Append a copy of the directory entry, entry, to batch.
+
+*/
+
+static void batch_add(rhbatch_t *batch, rhdirent_t *entry)
+{
+	batchent_t *ent;
+	size_t len;
+
+	if (batch->n == batch->alloc)
+	{
+		batch->alloc = (batch->alloc) ? batch->alloc * 2 : (batch->size) ? batch->size : 256;
+		batch->ent = realloc_or_fatalsys(batch->ent, batch->alloc * sizeof(batchent_t));
+	}
+
+	len = strlen(entry->name) + 1;
+
+	if (batch->names_len + len > batch->names_size)
+	{
+		#define max(a, b) ((a) > (b) ? (a) : (b))
+		batch->names_size = max(batch->names_size * 2, batch->names_len + len + 4096);
+		#undef max
+		batch->names = realloc_or_fatalsys(batch->names, batch->names_size);
+	}
+
+	ent = &batch->ent[batch->n];
+	ent->namei = batch->names_len;
+	ent->ino = entry->ino;
+	ent->type = entry->type;
+	ent->seq = batch->n++;
+	memcpy(batch->names + batch->names_len, entry->name, len);
+	batch->names_len += len;
+}
+
+/*
+
+static int batch_read(rhdir_t *dir, rhbatch_t *batch);
+
+Read the next batch of entries from dir into batch, sort them by inode
+number for -O (or by name for -k), and fetch their stat(2) information if needed. Returns the
+number of entries read (0 at the end of the directory).
+
+*/
+
+static int batch_read(rhdir_t *dir, rhbatch_t *batch)
+{
+	rhdirent_t *entry;
+	int i;
+
+	for (batch->n = batch->next = 0, batch->names_len = 0; (!batch->size || batch->n < batch->size) && (entry = rawhide_readdir(dir)); )
+		batch_add(batch, entry);
+
+	if (!batch->n)
+		return 0;
+
+	/* Sort by inode number (and remember the directory order for -OO) */
+
+	if (attr.inode_order)
+	{
+		qsort(batch->ent, batch->n, sizeof(batchent_t), batch_inode_cmp);
+
+		if (attr.inode_order == 2)
+		{
+			batch->order = realloc_or_fatalsys(batch->order, batch->alloc * sizeof(int));
+
+			for (i = 0; i < batch->n; ++i)
+				batch->order[batch->ent[i].seq] = i;
+		}
+	}
+	else if (attr.name_order)
+	{
+		batch_names = batch->names;
+		qsort(batch->ent, batch->n, sizeof(batchent_t), batch_name_cmp);
+	}
+
+	/* Fetch the stat information (in inode order for -O) */
+
+	if (attr.inode_order == 2 || attr.io_uring)
+	{
+		batch->stat = realloc_or_fatalsys(batch->stat, batch->alloc * sizeof(batchstat_t));
+
+		for (i = 0; i < batch->n; ++i)
+			batch->stat[i].done = 0;
+
+		batch_stat(dir->fd, batch);
+	}
+
+	return batch->n;
+}
+
+/*
+
+static void batch_free(rhbatch_t *batch);
+
+Deallocate batch (if any).
+
+*/
+
+static void batch_free(rhbatch_t *batch)
+{
+	if (!batch)
+		return;
+
+	free(batch->ent);
+	free(batch->stat);
+	free(batch->order);
+	free(batch->names);
+	free(batch);
+}
+
+/*
+
+rhdirent_t *rawhide_readdir_batch(rhdir_t *dir);
+
+Like rawhide_readdir(), but for the -O option or RAWHIDE_IO_URING, read a
+batch of entries at a time, in inode number order for -O (or the whole
+directory in name order for -k), and fetch the
+stat(2) information that rawhide_stat() will need for them all at once if
+needed (see above). Any fetched information is used by the next call to
+rawhide_stat().
+
+*/
+
+rhdirent_t *rawhide_readdir_batch(rhdir_t *dir)
+{
+	rhbatch_t *batch = dir->batch;
+	batchent_t *ent;
+	int i;
+
+	batch_fetched = NULL;
+
+	if (!batch)
+	{
+		int size = 0;
+
+		#ifdef HAVE_IO_URING
+		if (attr.io_uring && uring_init() != -1)
+			size = uring->entries;
+		#endif
+
+		if (!size && !attr.inode_order && !attr.name_order)
+			return rawhide_readdir(dir);
+
+		batch = dir->batch = malloc_or_fatalsys(sizeof(rhbatch_t));
+		memset(batch, 0, sizeof(rhbatch_t));
+		batch->size = (attr.inode_order || attr.name_order) ? 0 : size;
+	}
+
+	if (batch->next == batch->n && !batch_read(dir, batch))
+		return NULL;
+
+	/* Return the next entry in the batch */
+
+	i = (attr.inode_order == 2) ? batch->order[batch->next++] : batch->next++;
+	ent = &batch->ent[i];
+	batch->entry->name = batch->names + ent->namei;
+	batch->entry->ino = ent->ino;
+	batch->entry->type = ent->type;
+
+	if (batch->stat && batch->stat[i].done)
+		batch_fetched = &batch->stat[i];
+
+	return batch->entry;
+}
+
+/*
+
+static void rawhide_suspenddir(rhdir_t *dir);
+
+Read the rest of the entries in the directory stream dir into its batch
+(after any that haven't been returned yet), and then close the underlying
+stream and file descriptor. Later calls to rawhide_readdir_batch() return
+the remaining entries from memory. Used by rawhide_traverse() to keep the
+number of open directories bounded (see level_close()).
+
+*/
+
+static void rawhide_suspenddir(rhdir_t *dir)
+{
+	rhbatch_t *batch = dir->batch;
+	rhdirent_t *entry;
+	int n, i;
+
+	if (dir->fd == -1)
+		return;
+
+	if (!batch)
+	{
+		batch = dir->batch = malloc_or_fatalsys(sizeof(rhbatch_t));
+		memset(batch, 0, sizeof(rhbatch_t));
+	}
+
+	for (n = batch->n; (entry = rawhide_readdir(dir)); )
+		batch_add(batch, entry);
+
+	/* The stat information for the new entries (if any) will be fetched one at a time */
+
+	if (batch->stat && batch->n > n)
+	{
+		batch->stat = realloc_or_fatalsys(batch->stat, batch->alloc * sizeof(batchstat_t));
+
+		for (i = n; i < batch->n; ++i)
+			batch->stat[i].done = 0;
+	}
+
+	rawhide_closedir_stream(dir);
+}
+
+/*
+
+static int rawhide_statat(int parent_fd, const char *name, int flags, int needs);
+
+Like fstatat() into attr.statbuf, but on Linux, use statx() to only
+request the fields in needs (NEED_* bits), including the birth/created
+time (which is kept for get_btime()). If the current entry's information
+was already fetched by rawhide_readdir_batch(), use that instead. Sets
+attr.stat_done to what attr.statbuf now contains. On success, returns 0.
+On error, returns -1 with errno set (and attr.statbuf unchanged).
+
+*/
+
+static int rawhide_statat(int parent_fd, const char *name, int flags, int needs)
+{
+	#if HAVE_STATX_BTIME
+	struct statx statxbuf[1];
+	#endif
+
+	if (batch_fetched && flags == AT_SYMLINK_NOFOLLOW && needs == attr.needs)
+	{
+		batchstat_t *st = batch_fetched;
+
+		batch_fetched = NULL;
+
+		if (st->res < 0)
+			return errno = -st->res, -1;
+
+		#if HAVE_STATX_BTIME
+		statx_statbuf(st->statxbuf, needs);
+		#else
+		*attr.statbuf = *st->statbuf;
+		attr.stat_done = NEED_STAT;
+		#endif
+
+		return 0;
+	}
+
+	#if HAVE_STATX_BTIME
+	if (!statx_unavailable)
+	{
+		if (statx(parent_fd, name, flags, statx_mask(needs), statxbuf) != -1)
+		{
+			statx_statbuf(statxbuf, needs);
+
+			return 0;
+		}
+
+		if (errno != ENOSYS)
+			return -1;
+
+		statx_unavailable = 1;
+	}
+	#endif
+
+	if (fstatat(parent_fd, name, attr.statbuf, flags) == -1)
+		return -1;
+
+	attr.stat_done = NEED_STAT;
+
+	return 0;
+}
+
+/*
+
+static int rawhide_fstatat(int parent_fd, char *basename, int needs);
+
+Stat the current entry (attr.fpath) into attr.statbuf, following symlinks
+if requested. The parent_fd and basename parameters are as for
+rawhide_traverse(). The needs parameter is what's needed (NEED_* bits).
+On success, returns 0. On error, returns -1.
+
+*/
+
+static int rawhide_fstatat(int parent_fd, char *basename, int needs)
+{
+	char *name = (parent_fd == AT_FDCWD) ? attr.fpath : basename;
+
+	debug(("fstatat(parent_fd=%d, path=%s, needs=0x%04x)", parent_fd, name, needs));
+
+	if (attr.test_fstatat_failure && !strcmp(attr.test_fstatat_failure, attr.fpath))
+		errno = EPERM;
+
+	if ((attr.test_fstatat_failure && !strcmp(attr.test_fstatat_failure, attr.fpath)) || rawhide_statat(parent_fd, name, AT_SYMLINK_NOFOLLOW, needs) == -1)
+		return errorsys("fstatat %s", ok(attr.fpath));
+
+	debug(("fstatat: basename %s type %o perm %o uid %d gid %d size %d", (basename) ? basename : "N/A", attr.statbuf->st_mode & S_IFMT, attr.statbuf->st_mode & ~S_IFMT, attr.statbuf->st_uid, attr.statbuf->st_gid, attr.statbuf->st_size));
+	attr.followed = 0;
+
+	/* Follow symlinks if requested. Overwrite attr.statbuf on success. */
+	/* On failure, continue with the symlink's statbuf, like find(1). */
+
+	if (islink(attr.statbuf) && following_symlinks())
+	{
+		if (rawhide_statat(parent_fd, name, 0, needs) == -1)
+		{
+			attr.stat_done &= ~NEED_BTIME; /* That was the symlink's */
+
+			if (attr.report_broken_symlinks)
+			{
+				errorsys("fstatat %s (following symlink)", ok(attr.fpath));
+				attr.exit_status = EXIT_FAILURE;
+			}
+		}
+
+		debug(("fstatat: basename %s type %o perm %o uid %d gid %d size %d", (basename) ? basename : "N/A", attr.statbuf->st_mode & S_IFMT, attr.statbuf->st_mode & ~S_IFMT, attr.statbuf->st_uid, attr.statbuf->st_gid, attr.statbuf->st_size));
+		attr.followed = 1;
+	}
+
+	return 0;
+}
+
+static int index_stat(void);
+static int index_changed(void);
+
+/*
+
+static int rawhide_stat(int parent_fd, char *basename);
+
+Prepare attr.statbuf for the current entry. If the search criteria only
+need the path and file type (see rawhide_needs()), and the directory entry
+contains the file type, then skip fstatat(), and only set the file type
+and inode number in attr.statbuf. Directories (and symlinks that are to be
+followed) are always statted, because the traversal needs them. Otherwise,
+it's rawhide_fstatat() for what the search criteria need (unless it comes
+from an old index, see index_stat()).
+
+*/
+
+static int rawhide_stat(int parent_fd, char *basename)
+{
+	int rc;
+
+	if (index_stat())
+		return 0;
+
+	#ifdef DTTOIF
+	if (stat_elidable(attr.dirent_type))
+	{
+		debug(("fstatat skipped: basename %s type %o", basename, DTTOIF(attr.dirent_type)));
+		memset(attr.statbuf, 0, sizeof(struct stat));
+		attr.statbuf->st_mode = DTTOIF(attr.dirent_type);
+		attr.statbuf->st_ino = attr.dirent_ino;
+		attr.followed = 0;
+		attr.stat_done = NEED_TYPE | NEED_INO;
+
+		return 0;
+	}
+	#endif
+
+	rc = rawhide_fstatat(parent_fd, basename, attr.needs);
+
+	batch_fetched = NULL;
+
+	return rc;
+}
+
+/*
+
+static int rawhide_stat_visit(void);
+
+If the visit function needs more of the current (matching) entry's stat(2)
+fields than the search criteria did (e.g., -l), stat it again now. On
+success, returns 0. On error, returns -1.
+
+*/
+
+static int rawhide_stat_visit(void)
+{
+	off_t dirsize;
+
+	if (!(attr.visit_needs & NEED_STAT & ~attr.stat_done))
+		return 0;
+
+	dirsize = attr.statbuf->st_size; /* Keep any directory size that's already been counted */
+
+	if (rawhide_fstatat(attr.parent_fd, attr.basename, attr.needs | attr.visit_needs) == -1)
+		return attr.exit_status = EXIT_FAILURE, -1;
+
+	if (attr.dirsize_done)
+		attr.statbuf->st_size = dirsize;
+
+	return 0;
+}
+
+/*
+
+Sharding (-A)
+
+With -A i/N, a search is split into N shards that can be searched by
+independent processes (e.g., on different machines that mount the same
+filesystem), and only shard i is searched. Each entry at the split depth
+(RAWHIDE_SHARD_DEPTH, default 1) belongs to the shard selected by a hash
+(FNV-1a, with a final mix) of its path relative to the search path, and
+so does everything under it. Other shards' directories at the split depth
+aren't searched.
+Entries above the split depth are searched by every shard (to reach the
+split depth), but they only match in shard 1. So the shards are disjoint,
+and together they are the same as the whole search. The hash doesn't
+depend on anything but the relative path, so it's the same everywhere.
+
+Every shard still applies the search criteria to the entries that it
+searches (so that prune works the same in all of them), but only the
+shard's own entries can match.
+
+*/
+
+/*
+
+static int shard_owned(void);
+
+Return whether or not the current entry belongs to this shard (for -A).
+
+*/
+
+static int shard_owned(void)
+{
+	const char *s = attr.fpath + attr.search_path_len;
+	ullong hash = 14695981039346656037ULL;
+	llong depth = 0;
+
+	if (attr.depth < attr.shard_depth)
+		return attr.shard == 1;
+
+	/* Hash the relative path of its ancestor at the split depth (or itself) */
+
+	while (*s == '/')
+		++s;
+
+	for (; *s; ++s)
+	{
+		if (*s == '/' && ++depth == attr.shard_depth)
+			break;
+
+		hash ^= (unsigned char)*s;
+		hash *= 1099511628211ULL;
+	}
+
+	/* Mix the high bits into the low bits (short paths don't spread well modulo small numbers) */
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return hash % attr.shards == attr.shard - 1;
+}
+
+static void rawhide_visit(void);
+static void rawhide_exit(void);
+
+/*
+
+static void rawhide_evaluate(int parent_fd, char *basename);
+
+Test the current entry (attr.fpath and attr.statbuf) against the search
+criteria, and call the visit function if it matches. Exit if requested.
+
+*/
+
+static void rawhide_evaluate(int parent_fd, char *basename)
+{
+	caches_init();
+	attr.parent_fd = parent_fd;
+	attr.basename = basename;
+
+	if (rawhide_execute() && !attr.pruned)
+		if (attr.depth >= attr.min_depth && (!attr.shards || shard_owned()) && index_changed() && rawhide_stat_visit() != -1)
+			rawhide_visit();
+
+	caches_done();
+
+	if (attr.exit)
+		rawhide_exit();
+}
+
+/*
+
+static size_t point_hash(dev_t dev, ino_t ino);
+
+Return a hash of a directory's device and inode number.
+
+*/
+
+static size_t point_hash(dev_t dev, ino_t ino)
+{
+	ullong h = (ullong)ino * 0x9e3779b97f4a7c15ULL ^ (ullong)dev * 0xc2b2ae3d27d4eb4fULL;
+
+	return (size_t)(h ^ (h >> 32));
+}
+
+/*
+
+static int search_stack_contains(dev_t dev, ino_t ino);
+
+Return whether or not the directory with the given device and inode number
+is on the search stack (i.e., it's an ancestor of the current entry).
+The search stack is hashed, so this doesn't depend on the depth.
+
+*/
+
+static int search_stack_contains(dev_t dev, ino_t ino)
+{
+	llong i;
+
+	if (!attr.search_hash)
+		return 0;
+
+	for (i = attr.search_hash[point_hash(dev, ino) & (attr.search_hash_size - 1)]; i != -1; i = attr.search_stack[i].next)
+	{
+		debug(("check search stack[%d] %d/%d looking for %d/%d", (int)i, attr.search_stack[i].dev, attr.search_stack[i].ino, dev, ino));
+
+		if (attr.search_stack[i].dev == dev && attr.search_stack[i].ino == ino)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+
+static int search_stack_grow(llong depth);
+
+Make room on the search stack for a search point at depth (if needed). The
+search stack's hash table grows to have at least as many buckets as there
+are search points. Returns whether or not the hash table grew (and so needs
+to be rebuilt with search_stack_rehash()).
+
+*/
+
+static int search_stack_grow(llong depth)
+{
+	if ((size_t)depth < attr.search_hash_size)
+		return 0;
+
+	while ((size_t)depth >= attr.search_hash_size)
+		attr.search_hash_size = (attr.search_hash_size) ? attr.search_hash_size * 2 : 64;
+
+	attr.search_hash = realloc_or_fatalsys(attr.search_hash, attr.search_hash_size * sizeof(llong));
+	attr.search_stack = realloc_or_fatalsys(attr.search_stack, (attr.search_stack_size = attr.search_hash_size) * sizeof(point_t));
+
+	return 1;
+}
+
+/*
+
+static void search_stack_rehash(llong depth);
+
+Rebuild the search stack's hash table from the search points below depth.
+This is from the bottom up, so the newest point is first in each bucket.
+
+*/
+
+static void search_stack_rehash(llong depth)
+{
+	size_t bucket;
+	llong i;
+
+	memset(attr.search_hash, 0xff, attr.search_hash_size * sizeof(llong));
+
+	for (i = 0; i < depth; ++i)
+	{
+		bucket = point_hash(attr.search_stack[i].dev, attr.search_stack[i].ino) & (attr.search_hash_size - 1);
+		attr.search_stack[i].next = attr.search_hash[bucket];
+		attr.search_hash[bucket] = i;
+	}
+}
+
+/*
+
+static void search_stack_push(void);
+
+Push the current directory (attr.statbuf) onto the search stack (at
+attr.depth), and add it to the search stack's hash table. The search stack
+and its hash table grow as needed.
+
+*/
+
+static void search_stack_push(void)
+{
+	point_t *point;
+	size_t bucket;
+
+	if (search_stack_grow(attr.depth))
+		search_stack_rehash(attr.depth);
+
+	point = &attr.search_stack[attr.depth];
+	point->dev = attr.statbuf->st_dev;
+	point->ino = attr.statbuf->st_ino;
+	bucket = point_hash(point->dev, point->ino) & (attr.search_hash_size - 1);
+	point->next = attr.search_hash[bucket];
+	attr.search_hash[bucket] = attr.depth;
+}
+
+/*
+
+static void search_stack_pop(void);
+
+Remove the top of the search stack (at attr.depth) from the search stack's
+hash table. It's always first in its bucket, because it's the newest.
+
+*/
+
+static void search_stack_pop(void)
+{
+	point_t *point = &attr.search_stack[attr.depth];
+
+	attr.search_hash[point_hash(point->dev, point->ino) & (attr.search_hash_size - 1)] = point->next;
+}
+
+/*
+
+Directories that have been searched (for the -YY option).
+
+This is a hash set of (dev, ino) pairs (open addressing, linear probing),
+shared by all threads. An inode number of zero marks an empty slot (no
+real directory has inode number zero).
+
+*/
+
+static point_t *visited;            /* The hash set */
+static size_t visited_size;         /* Number of slots (power of 2) */
+static size_t visited_count;        /* Number of directories */
+static pthread_mutex_t visited_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects the hash set (for -P and -J) */
+
+/*
+
+static int visited_add(dev_t dev, ino_t ino);
+
+Add a directory with the given device and inode number to the set of
+searched directories. Returns 1 if it was added, or 0 if it was already
+there.
+
+*/
+
+static int visited_add(dev_t dev, ino_t ino)
+{
+	point_t *old;
+	size_t old_size, i, j;
+	int added = 0;
+
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_lock(&visited_lock);
+
+	/* Grow at 50% load */
+
+	if (visited_count * 2 >= visited_size)
+	{
+		old = visited;
+		old_size = visited_size;
+		visited_size = (visited_size) ? visited_size * 2 : 1024;
+		visited = malloc_or_fatalsys(visited_size * sizeof(point_t));
+		memset(visited, 0, visited_size * sizeof(point_t));
+
+		for (i = 0; i < old_size; ++i)
+		{
+			if (!old[i].ino)
+				continue;
+
+			for (j = point_hash(old[i].dev, old[i].ino) & (visited_size - 1); visited[j].ino; j = (j + 1) & (visited_size - 1))
+			{}
+
+			visited[j] = old[i];
+		}
+
+		free(old);
+	}
+
+	for (i = point_hash(dev, ino) & (visited_size - 1); visited[i].ino; i = (i + 1) & (visited_size - 1))
+		if (visited[i].dev == dev && visited[i].ino == ino)
+			break;
+
+	if (!visited[i].ino)
+	{
+		visited[i].dev = dev;
+		visited[i].ino = ino;
+		++visited_count;
+		added = 1;
+	}
+
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_unlock(&visited_lock);
+
+	return added;
+}
+
+/*
+
+static int rawhide_revisiting(void);
+
+For the -YY option, record that the current entry (a directory that is
+about to be searched) has been searched, and return whether or not it was
+already searched (via another path, so it needn't be searched again).
+Filesystem cycles must be checked first (so that they are still reported).
+
+*/
+
+static int rawhide_revisiting(void)
+{
+	if (!attr.skip_revisits || !attr.statbuf->st_ino)
+		return 0;
+
+	if (visited_add(attr.statbuf->st_dev, attr.statbuf->st_ino))
+		return 0;
+
+	debug(("skipping %s: Already searched", attr.fpath));
+
+	return 1;
+}
+
+/*
+
+Filesystem types (.fstype and -K)
+
+The mount table (/proc/self/mountinfo on Linux) is read once, when it's
+first needed, and kept sorted by device number, so that each directory's
+filesystem type can be looked up from its st_dev without any system calls.
+That's what lets -K skip whole classes of filesystems (e.g., proc, sysfs,
+cgroup2, nfs, fuse.*) before any openat() is attempted on them. Each mount
+is checked against the -K glob patterns when the table is read.
+
+If a device isn't in the table (e.g., it was mounted after the table was
+read), the table is read again, but only once per unknown device.
+Elsewhere, filesystem types are unknown (i.e., the empty string).
+
+Other threads (for -P and -J) might still be using the filesystem types
+from before the table was read again, so the type names are kept in a
+separate list that only grows (there are only a few distinct types), and
+they are never deallocated. Nor is the mount table itself, because another
+thread might still be searching it when the process exits.
+
+*/
+
+typedef struct mount_t mount_t;
+struct mount_t
+{
+	dev_t dev;              /* The filesystem's device number */
+	const char *fstype;     /* The filesystem's type (or "" if unknown, see fstype_intern()) */
+	int skip;               /* Does it match -K? */
+};
+
+static mount_t *mounts;             /* The mount table (sorted by dev) */
+static size_t mounts_count;         /* Number of mounts */
+static pthread_mutex_t mounts_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects the mount table (for -P and -J) */
+
+typedef struct fstype_t fstype_t;
+struct fstype_t
+{
+	fstype_t *next;         /* The next filesystem type */
+	char name[];            /* The filesystem type's name */
+};
+
+static fstype_t *fstypes;           /* Every filesystem type in any mount table read so far */
+
+/*
+
+static int mount_cmp(const void *a, const void *b);
+
+Compare mounts by device number (for qsort() and bsearch()).
+
+*/
+
+static int mount_cmp(const void *a, const void *b)
+{
+	const mount_t *ma = a, *mb = b;
+
+	return (ma->dev < mb->dev) ? -1 : (ma->dev > mb->dev) ? 1 : 0;
+}
+
+/*
+
+static int mount_skipped(const char *fstype);
+
+Return whether or not the given filesystem type matches any of the
+comma-separated glob patterns in attr.skip_fstypes (for -K).
+
+*/
+
+static int mount_skipped(const char *fstype)
+{
+	char pattern[256];
+	const char *s, *e;
+
+	if (!attr.skip_fstypes || !*fstype)
+		return 0;
+
+	for (s = attr.skip_fstypes; *s; s = (*e) ? e + 1 : e)
+	{
+		if (!(e = strchr(s, ',')))
+			e = s + strlen(s);
+
+		if (e == s || e - s >= sizeof pattern)
+			continue;
+
+		memcpy(pattern, s, e - s);
+		pattern[e - s] = '\0';
+
+		if (attr.fnmatch(pattern, fstype, 0) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+
+static const char *fstype_intern(const char *fstype);
+
+Return the given filesystem type's copy in the list of filesystem types
+(adding it if necessary). The copy is never deallocated. Must be called
+with mounts_lock held (for -P and -J).
+
+*/
+
+static const char *fstype_intern(const char *fstype)
+{
+	fstype_t *type;
+
+	for (type = fstypes; type; type = type->next)
+		if (!strcmp(type->name, fstype))
+			return type->name;
+
+	type = malloc_or_fatalsys(sizeof(fstype_t) + strlen(fstype) + 1);
+	strcpy(type->name, fstype);
+	type->next = fstypes;
+	fstypes = type;
+
+	return type->name;
+}
+
+/*
+
+static void mount_add(dev_t dev, const char *fstype, size_t *size);
+
+Add a mount with the given device number and filesystem type to the end of
+the mount table (unsorted), growing it as needed.
+
+*/
+
+static void mount_add(dev_t dev, const char *fstype, size_t *size)
+{
+	if (mounts_count == *size)
+		mounts = realloc_or_fatalsys(mounts, (*size = (*size) ? *size * 2 : 64) * sizeof(mount_t));
+
+	mounts[mounts_count].dev = dev;
+	mounts[mounts_count].fstype = fstype_intern(fstype);
+	mounts[mounts_count].skip = mount_skipped(fstype);
+	++mounts_count;
+}
+
+/*
+
+static void mounts_load(dev_t unknown);
+
+Read the mount table from /proc/self/mountinfo (replacing any previous
+table, but not its filesystem types, see fstype_intern()). Lines look like:
+
+  36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw
+
+i.e., the third field is the device's major:minor, and the filesystem
+type is the first field after the " - " separator. If the given unknown
+device number still isn't there afterwards, it's added with an unknown
+filesystem type, so that it won't cause the table to be read again.
+
+*/
+
+static void mounts_load(dev_t unknown)
+{
+	size_t size = mounts_count;
+	unsigned int dev_major, dev_minor;
+	char *line = NULL, *sep, *fstype, *end;
+	size_t line_size = 0;
+	FILE *mountinfo;
+	int known = 0;
+
+	mounts_count = 0;
+
+	if ((mountinfo = fopen("/proc/self/mountinfo", "r")))
+	{
+		while (getline(&line, &line_size, mountinfo) != -1)
+		{
+			if (sscanf(line, "%*s %*s %u:%u", &dev_major, &dev_minor) != 2)
+				continue;
+
+			if (!(sep = strstr(line, " - ")))
+				continue;
+
+			fstype = sep + 3;
+			end = fstype + strcspn(fstype, " \n");
+			*end = '\0';
+
+			mount_add(makedev(dev_major, dev_minor), fstype, &size);
+
+			if (mounts[mounts_count - 1].dev == unknown)
+				known = 1;
+		}
+
+		free(line);
+		fclose(mountinfo);
+	}
+
+	if (!known)
+		mount_add(unknown, "", &size);
+
+	qsort(mounts, mounts_count, sizeof(mount_t), mount_cmp);
+}
+
+/*
+
+static mount_t *mount_lookup(dev_t dev);
+
+Return the mount table entry for the given device number (reading the
+mount table if necessary). Must be called with mounts_lock held (for -P
+and -J).
+
+*/
+
+static mount_t *mount_lookup(dev_t dev)
+{
+	mount_t key[1], *mount;
+
+	key->dev = dev;
+
+	if (!(mount = bsearch(key, mounts, mounts_count, sizeof(mount_t), mount_cmp)))
+	{
+		mounts_load(dev);
+		mount = bsearch(key, mounts, mounts_count, sizeof(mount_t), mount_cmp);
+	}
+
+	return mount;
+}
+
+/*
+
+const char *rawhide_fstype(dev_t dev);
+
+Return the filesystem type of the filesystem with the given device number,
+or the empty string if it's not known. The result remains valid (even if
+another thread reads the mount table again), because filesystem type names
+are never deallocated.
+
+*/
+
+const char *rawhide_fstype(dev_t dev)
+{
+	const char *fstype;
+
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_lock(&mounts_lock);
+
+	fstype = mount_lookup(dev)->fstype;
+
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_unlock(&mounts_lock);
+
+	return fstype;
+}
+
+/*
+
+static int fstype_skipped(dev_t dev);
+
+Return whether or not the filesystem with the given device number has a
+type that is to be skipped (for -K).
+
+*/
+
+static int fstype_skipped(dev_t dev)
+{
+	int skip;
+
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_lock(&mounts_lock);
+
+	skip = mount_lookup(dev)->skip;
+
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_unlock(&mounts_lock);
+
+	return skip;
+}
+
+/*
+
+static int rawhide_descending(void);
+
+Return whether or not the current entry is a directory that should be
+searched: not too deep, not pruned, on the same filesystem for -1, not on
+a filesystem type that is skipped for -K (except for the search paths
+themselves), and might contain matches (if the search criteria contain
+path patterns).
+
+*/
+
+static int rawhide_descending(void)
+{
+	if (!isdir(attr.statbuf) || attr.depth >= attr.max_depth || attr.prune || (attr.single_filesystem && attr.statbuf->st_dev != attr.fs_dev))
+		return 0;
+
+	if (attr.skip_fstypes && attr.depth && fstype_skipped(attr.statbuf->st_dev))
+	{
+		debug(("skipping %s: Filesystem type %s", attr.fpath, rawhide_fstype(attr.statbuf->st_dev)));
+
+		return 0;
+	}
+
+	if (attr.path_pruning && !rawhide_path_matchable(attr.fpath))
+	{
+		debug(("skipping %s: No matching paths inside", attr.fpath));
+
+		return 0;
+	}
+
+	if (attr.shards && attr.depth == attr.shard_depth && !shard_owned())
+	{
+		debug(("skipping %s: In another shard", attr.fpath));
+
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+
+Bounded directory file descriptors (RAWHIDE_FD_WINDOW)
+
+rawhide_traverse() keeps a directory open while searching its entries, so
+ordinarily, the depth of the search is limited by the number of open
+files. Instead, for sequential searches, only the deepest attr.fd_window
+levels of directories being searched are kept open (default 256).
+
+When descending any deeper, the shallowest open level has the rest of its
+entries read into memory (see rawhide_suspenddir()), and its file
+descriptor is closed. When the search returns to that level, the directory
+is reopened with openat() relative to the nearest ancestor that is still
+open (reopening any intermediate levels along the way), with O_NOFOLLOW
+(unless it was reached via a symlink). Its device and inode number are
+checked against the search stack, so that a directory that was renamed or
+replaced in the meantime isn't mistaken for the original.
+
+The depth parameters of the level_*() functions below are relative to
+levels_base (the depth at which rawhide_traverse_dir() was first called).
+
+*/
+
+typedef struct level_t level_t;
+struct level_t
+{
+	rhdir_t *dir;      /* The directory's stream (closed when suspended) */
+	int fd;            /* The directory's file descriptor, or -1 if closed */
+	size_t name_posi;  /* Offset of the directory's name in attr.fpath */
+	size_t nul_posi;   /* Offset of the end of the directory's name in attr.fpath */
+	int followed;      /* Was the directory reached via a symlink? */
+};
+
+static THREAD_LOCAL level_t *levels;     /* The directories being searched (indexed by depth - levels_base) */
+static THREAD_LOCAL size_t levels_size;  /* Number of levels allocated */
+static THREAD_LOCAL llong levels_base;   /* Depth of the first level (non-zero for -W, see bfs_entry()) */
+
+/*
+
+static void level_close(llong depth);
+
+Close the directory at the given depth, reading the rest of its entries
+into memory first if its stream is still open.
+
+*/
+
+static void level_close(llong depth)
+{
+	level_t *level = &levels[depth];
+
+	if (level->fd == -1)
+		return;
+
+	debug(("close level %lld fd %d", depth, level->fd));
+
+	if (level->dir->fd != -1)
+		rawhide_suspenddir(level->dir);
+	else
+		close(level->fd);
+
+	level->fd = -1;
+}
+
+/*
+
+static void level_enter(rhdir_t *dir, size_t name_posi, size_t nul_posi);
+
+Record that the directory stream dir (whose name is at name_posi up to
+nul_posi in attr.fpath) is being searched at the current depth, and close
+the level that is now outside the window of open directories.
+
+*/
+
+static void level_enter(rhdir_t *dir, size_t name_posi, size_t nul_posi)
+{
+	llong depth = attr.depth - levels_base;
+	level_t *level;
+
+	if ((size_t)depth >= levels_size)
+	{
+		levels_size = (levels_size) ? levels_size * 2 : 64;
+		levels = realloc_or_fatalsys(levels, levels_size * sizeof(level_t));
+	}
+
+	level = &levels[depth];
+	level->dir = dir;
+	level->fd = dir->fd;
+	level->name_posi = (depth) ? name_posi : 0; /* The first level is reopened with its full path */
+	level->nul_posi = nul_posi;
+	level->followed = attr.followed;
+
+	if (depth >= attr.fd_window)
+		level_close(depth - attr.fd_window);
+}
+
+/*
+
+static int level_open(llong depth, int parent_fd, const char *name, int flags);
+
+Reopen the directory at the given depth as name relative to parent_fd
+(with the additional open flags, flags), and check that it's the same
+directory (its device and inode number are on the search stack). On
+success, returns the file descriptor. On error, returns -1 with errno set
+by openat() or fstat(). If it's a different directory, returns -2.
+
+*/
+
+static int level_open(llong depth, int parent_fd, const char *name, int flags)
+{
+	struct stat statbuf[1];
+	int fd, save_errno;
+
+	debug(("reopen level %lld: openat(parent_fd=%d, path=%s)", depth, parent_fd, name));
+
+	if ((fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | flags)) == -1)
+		return -1;
+
+	if (fstat(fd, statbuf) == -1)
+	{
+		save_errno = errno;
+		close(fd);
+		errno = save_errno;
+
+		return -1;
+	}
+
+	if (statbuf->st_dev != attr.search_stack[levels_base + depth].dev || statbuf->st_ino != attr.search_stack[levels_base + depth].ino)
+	{
+		close(fd);
+
+		return -2;
+	}
+
+	/* Prevent leaking this file descriptor into child processes */
+
+	fcntl_set_fdflag(fd, FD_CLOEXEC);
+
+	return fd;
+}
+
+/*
+
+static void level_exit(llong depth);
+
+Finish with the directory at the given depth. If its parent has been
+closed, reopen it now via "..", which is quicker than reopening it from
+the nearest open ancestor later (if that doesn't work, e.g. because the
+directory was reached via a symlink, it's left for level_fd()). Then close
+the directory's file descriptor if it was reopened (otherwise,
+rawhide_closedir() closes it).
+
+*/
+
+static void level_exit(llong depth)
+{
+	level_t *level = &levels[depth];
+	int fd;
+
+	if (level->fd == -1)
+		return;
+
+	if (depth && levels[depth - 1].fd == -1 && (fd = level_open(depth - 1, level->fd, "..", 0)) >= 0)
+		levels[depth - 1].fd = fd;
+
+	if (level->dir->fd == -1)
+		close(level->fd);
+}
+
+/*
+
+static int level_fd(llong depth);
+
+Return the file descriptor for the directory at the given depth,
+reopening it (and any closed ancestors within the window) if necessary.
+On error, returns -1 after reporting it.
+
+*/
+
+static int level_fd(llong depth)
+{
+	level_t *level;
+	int parent_fd, fd, keep;
+	llong i;
+	char c;
+
+	if (levels[depth].fd != -1)
+		return levels[depth].fd;
+
+	/* Find the nearest open ancestor (or start from the search path itself) */
+
+	for (i = depth; i >= 0 && levels[i].fd == -1; --i)
+		;
+
+	parent_fd = (i >= 0) ? levels[i].fd : AT_FDCWD;
+	keep = 1;
+
+	/* Reopen each level from there */
+
+	for (++i; i <= depth; ++i)
+	{
+		level = &levels[i];
+		c = attr.fpath[level->nul_posi];
+		attr.fpath[level->nul_posi] = '\0';
+
+		if ((fd = level_open(i, parent_fd, attr.fpath + level->name_posi, (level->followed) ? 0 : O_NOFOLLOW)) == -1)
+			errorsys("%s", ok(attr.fpath));
+		else if (fd == -2)
+			error("%s: Directory replaced during the search", ok(attr.fpath));
+
+		attr.fpath[level->nul_posi] = c;
+
+		if (!keep)
+			close(parent_fd);
+
+		if (fd < 0)
+			return -1;
+
+		/* Keep it if it's within the window */
+
+		if ((keep = (i > depth - attr.fd_window)))
+			level->fd = fd;
+
+		parent_fd = fd;
+	}
+
+	return levels[depth].fd;
+}
+
+/*
+
+Prefetching (RAWHIDE_PREFETCH)
+
+On cold caches, a sequential search spends most of its time waiting for
+directories and inodes to be read from storage, one at a time. With
+RAWHIDE_PREFETCH set to a number of threads, those threads run ahead of
+rawhide_traverse(), reading the directories that it will reach soon, and
+statting their entries, so that the kernel's dentry and inode caches are
+warm by the time it gets there. Nothing they do is reported, and
+everything is still tested in the usual order by the main thread.
+
+When the main thread opens a directory, its path is pushed onto a stack of
+directories to prefetch at level 0. A prefetch thread pops the most recent
+one (i.e., the next in depth-first order), reads its entries, and statts
+them (except at level 0, which the main thread is reading already). Its
+subdirectories are then pushed (in reverse, so that the first is on top) at
+the next level, until RAWHIDE_PREFETCH_DEPTH levels ahead (default 1).
+The stack is bounded, and the oldest directories (i.e., the furthest
+ahead) are dropped when it's full.
+
+Paths are relative to the current working directory when the search
+started. Directories that can't be opened (e.g., the path is too long) are
+silently skipped, because the main thread will report any problems itself.
+
+*/
+
+#define PREFETCH_STACK_SIZE 1024
+
+typedef struct prefetch_t prefetch_t;
+struct prefetch_t
+{
+	llong level;            /* Levels ahead of the main thread (0 = being read by it) */
+	char path[];            /* Path of the directory */
+};
+
+static prefetch_t *prefetch_stack[PREFETCH_STACK_SIZE]; /* Directories to prefetch (a ring buffer) */
+static size_t prefetch_bottom;      /* Index of the oldest directory */
+static size_t prefetch_count;       /* Number of directories */
+static llong prefetch_nread;        /* Number of directories read ahead (for debugging) */
+static int prefetch_done;           /* Set when the threads are to finish */
+static int prefetch_cwd_fd = -1;    /* The cwd when the search started */
+static int prefetch_nthreads;       /* Number of prefetch threads (0 when not prefetching) */
+static pthread_t *prefetch_threads; /* The prefetch threads */
+static runtime_t *prefetch_attr;    /* The main thread's attr (for configuration) */
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects the above */
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;   /* Signals new work or finishing */
+
+/*
+
+static void prefetch_push_locked(const char *path, size_t len, llong level);
+
+Push a directory onto the prefetch stack (dropping the oldest if it's
+full). Must be called with prefetch_lock held.
+
+*/
+
+static void prefetch_push_locked(const char *path, size_t len, llong level)
+{
+	prefetch_t *item = malloc_or_fatalsys(sizeof(prefetch_t) + len + 1);
+
+	item->level = level;
+	memcpy(item->path, path, len);
+	item->path[len] = '\0';
+
+	if (prefetch_count == PREFETCH_STACK_SIZE)
+	{
+		free(prefetch_stack[prefetch_bottom]);
+		prefetch_bottom = (prefetch_bottom + 1) % PREFETCH_STACK_SIZE;
+		--prefetch_count;
+	}
+
+	prefetch_stack[(prefetch_bottom + prefetch_count++) % PREFETCH_STACK_SIZE] = item;
+}
+
+/*
+
+static void prefetch_push(const char *path);
+
+Let the prefetch threads know that the main thread has started reading the
+directory with the given path, so they can run ahead into its
+subdirectories. No-op when not prefetching.
+
+*/
+
+static void prefetch_push(const char *path)
+{
+	if (!prefetch_nthreads)
+		return;
+
+	pthread_mutex_lock(&prefetch_lock);
+	prefetch_push_locked(path, strlen(path), 0);
+	pthread_cond_signal(&prefetch_cond);
+	pthread_mutex_unlock(&prefetch_lock);
+}
+
+/*
+
+static void prefetch_dir(prefetch_t *item, char **names, size_t *names_size);
+
+Read the entries of the directory to prefetch, stat them (unless it's at
+level 0), and push its subdirectories (unless it's deep enough already).
+The names buffer (and its size) is reused for collecting the
+subdirectories' names.
+
+*/
+
+static void prefetch_dir(prefetch_t *item, char **names, size_t *names_size)
+{
+	size_t len = strlen(item->path), names_len = 0, pos, end, n;
+	int more = item->level < attr.prefetch_depth;
+	int dir_fd, stat_flags;
+	struct stat statbuf[1];
+	rhdirent_t *entry;
+	rhdir_t *dir;
+
+	if ((dir_fd = openat(prefetch_cwd_fd, item->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) == -1)
+		return;
+
+	if (!(dir = rawhide_opendir(dir_fd)))
+	{
+		close(dir_fd);
+
+		return;
+	}
+
+	stat_flags = (following_symlinks()) ? 0 : AT_SYMLINK_NOFOLLOW;
+
+	for (n = 0; (entry = rawhide_readdir(dir)); ++n)
+	{
+		/* Finish early if the search has finished */
+
+		if (n % 64 == 63)
+		{
+			pthread_mutex_lock(&prefetch_lock);
+
+			if (prefetch_done)
+				more = 0, entry = NULL;
+
+			pthread_mutex_unlock(&prefetch_lock);
+
+			if (!entry)
+				break;
+		}
+
+		statbuf->st_mode = 0;
+
+		if (item->level && !stat_elidable(entry->type))
+			(void)fstatat(dir_fd, entry->name, statbuf, stat_flags);
+
+		/* Collect subdirectories (from the entry's type, or from statting it) */
+
+		#ifdef DT_DIR
+		if (entry->type == DT_DIR)
+			statbuf->st_mode = S_IFDIR;
+		#endif
+
+		if (more && S_ISDIR(statbuf->st_mode))
+		{
+			size_t need = names_len + len + 1 + strlen(entry->name) + 1;
+
+			if (need > *names_size)
+				*names = realloc_or_fatalsys(*names, *names_size = need * 2);
+
+			pos = names_len;
+			memcpy(*names + pos, item->path, len);
+			pos += len;
+
+			if (len && item->path[len - 1] != '/')
+				(*names)[pos++] = '/';
+
+			strcpy(*names + pos, entry->name);
+			names_len = pos + strlen(entry->name) + 1;
+		}
+	}
+
+	rawhide_closedir(dir);
+
+	/* Push the subdirectories in reverse order (so the first one is on top) */
+
+	if (names_len)
+	{
+		pthread_mutex_lock(&prefetch_lock);
+
+		for (end = names_len - 1;; end = pos - 1)
+		{
+			for (pos = end; pos > 0 && (*names)[pos - 1]; --pos)
+			{}
+
+			prefetch_push_locked(*names + pos, end - pos, item->level + 1);
+
+			if (!pos)
+				break;
+		}
+
+		pthread_cond_broadcast(&prefetch_cond);
+		pthread_mutex_unlock(&prefetch_lock);
+	}
+}
+
+/*
+
+static void *prefetch_worker(void *arg);
+
+The start routine for the prefetch threads. Only the parts of attr that
+are needed for reading and statting directories are copied from the main
+thread.
+
+*/
+
+static void *prefetch_worker(void *arg)
+{
+	char *names = NULL;
+	size_t names_size = 0;
+	prefetch_t *item;
+
+	pthread_mutex_lock(&prefetch_lock);
+	attr.getdents_bufsize = prefetch_attr->getdents_bufsize;
+	attr.needs = prefetch_attr->needs;
+	attr.follow_symlinks = prefetch_attr->follow_symlinks;
+	attr.prefetch_depth = prefetch_attr->prefetch_depth;
+	attr.depth = 1;
+
+	for (;;)
+	{
+		while (!prefetch_count && !prefetch_done)
+			pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+
+		if (prefetch_done)
+			break;
+
+		item = prefetch_stack[(prefetch_bottom + --prefetch_count) % PREFETCH_STACK_SIZE];
+		pthread_mutex_unlock(&prefetch_lock);
+
+		prefetch_dir(item, &names, &names_size);
+		free(item);
+
+		pthread_mutex_lock(&prefetch_lock);
+		++prefetch_nread;
+	}
+
+	pthread_mutex_unlock(&prefetch_lock);
+	free(names);
+	getdents_buffers_free();
+
+	return NULL;
+}
+
+/*
+
+static void prefetch_start(void);
+
+Start attr.prefetch prefetch threads for a sequential search. If they
+can't be started, carry on without them.
+
+*/
+
+static void prefetch_start(void)
+{
+	int i, err;
+
+	if ((prefetch_cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		return;
+
+	prefetch_attr = &attr;
+	prefetch_done = 0;
+	prefetch_nread = 0;
+	prefetch_threads = malloc_or_fatalsys(attr.prefetch * sizeof(pthread_t));
+
+	for (i = 0; i < attr.prefetch; ++i)
+	{
+		if ((err = pthread_create(&prefetch_threads[i], NULL, prefetch_worker, NULL)))
+		{
+			debug(("prefetch: pthread_create: %s", strerror(err)));
+			break;
+		}
+	}
+
+	prefetch_nthreads = i;
+	debug(("prefetch: %d threads, depth %lld", prefetch_nthreads, attr.prefetch_depth));
+}
+
+/*
+
+static void prefetch_stop(void);
+
+Stop the prefetch threads, and discard any directories not yet prefetched.
+
+*/
+
+static void prefetch_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&prefetch_lock);
+	prefetch_done = 1;
+	pthread_cond_broadcast(&prefetch_cond);
+	pthread_mutex_unlock(&prefetch_lock);
+
+	for (i = 0; i < prefetch_nthreads; ++i)
+		pthread_join(prefetch_threads[i], NULL);
+
+	while (prefetch_count)
+		free(prefetch_stack[(prefetch_bottom + --prefetch_count) % PREFETCH_STACK_SIZE]);
+
+	debug(("prefetch: %lld directories read ahead", prefetch_nread));
+	free(prefetch_threads);
+	prefetch_threads = NULL;
+	prefetch_nthreads = 0;
+
+	if (prefetch_cwd_fd != -1)
+	{
+		close(prefetch_cwd_fd);
+		prefetch_cwd_fd = -1;
+	}
+}
+
+/*
+
+Index (-Z and -z) and snapshot (-C)
+
+With -Z, every entry that is searched is also written to an index file:
+a header, and then a record for each entry in the order that they were
+searched (each directory before its entries). A record contains the
+entry's depth, its stat(2) information, and its base name (or the whole
+path for search paths), so the index doesn't contain any full paths.
+Records are in the native byte order and struct stat layout, so an index
+is only meant to be used on the system that wrote it.
+
+If the index file already exists, it's used to avoid reading directories
+that haven't changed since it was written (the same device, inode number,
+mtime, and ctime, and last changed before the search that wrote it
+started). Their entries, and the stat(2) information of their
+non-directory entries, are taken from the old index instead. Only their
+subdirectories are statted (to see whether or not they have changed). The
+new index is written to a temporary file that replaces the old one when
+the search is finished.
+
+With -C, a snapshot is the same, except that the stat(2) information of
+the entries of unchanged directories isn't taken from the old snapshot.
+Their entries still aren't read from the filesystem, but every entry is
+statted, because files that are modified in place don't change their
+directory. Only entries that were created or changed since the old
+snapshot was written (i.e., whose ctime is no earlier than when that
+search started) are reported.
+
+With -z, the search criteria are applied to the entries in an index,
+rather than to the filesystem (see rawhide_search_index()).
+
+*/
+
+#define INDEX_MAGIC "rawhide index 2\n" /* 16 bytes (the version changes with the layout) */
+
+typedef struct ihdr_t ihdr_t;
+struct ihdr_t
+{
+	char magic[16];         /* INDEX_MAGIC */
+	llong snapshot;         /* Was it written by -C? */
+	llong start;            /* When the search that wrote it started (filesystem time, in nanoseconds) */
+};
+
+typedef struct irec_t irec_t;
+struct irec_t
+{
+	llong depth;            /* Depth of the entry (0 for the search path) */
+	llong len;              /* Length of the name */
+	llong followed;         /* Was a symlink followed to the entry? */
+	struct stat statbuf[1]; /* The entry's stat(2) information */
+	char name[];            /* The name (nul-terminated, and padded to a multiple of 8 bytes) */
+};
+
+#define IREC_SIZE(len) ((sizeof(irec_t) + (len) + 1 + 7) & ~(size_t)7)
+
+typedef struct idir_t idir_t;
+struct idir_t
+{
+	size_t rec;             /* Offset of the directory's record in the old index (0 for an empty slot) */
+	size_t end;             /* Offset after the records of its descendants */
+};
+
+static char *index_fname;          /* The index's path (-Z or -C) */
+static int index_snapshot;         /* Is it a snapshot (-C)? */
+static llong index_since = -1;     /* When the search that wrote the old index started (-1 if none) */
+static char *index_tmpname;        /* The new index's temporary path */
+static FILE *index_out;            /* The new index */
+static char *index_old;            /* The old index (mapped into memory) */
+static size_t index_old_size;      /* The old index's size */
+static idir_t *index_dirs;         /* The old index's directories (hashed by device and inode number) */
+static size_t index_dirs_size;     /* Number of slots (power of 2) */
+static irec_t *index_fetched;      /* The current entry's record in the old index (see index_stat()) */
+static rhdirent_t index_entry[1];  /* The current entry (see index_readdir()) */
+
+/*
+
+static irec_t *index_rec(char *index, size_t index_size, size_t pos, const char *fname);
+
+Return the record at the given offset in an index (mapped into memory).
+It's a fatal error if the record is corrupt.
+
+*/
+
+static irec_t *index_rec(char *index, size_t index_size, size_t pos, const char *fname)
+{
+	irec_t *rec = (irec_t *)(index + pos);
+
+	if (pos + sizeof(irec_t) > index_size || rec->depth < 0 || rec->len < 0 || rec->len > index_size || pos + IREC_SIZE(rec->len) > index_size || rec->name[rec->len])
+		fatal("%s: Corrupt index", ok(fname));
+
+	return rec;
+}
+
+/*
+
+static char *index_map(const char *fname, size_t *size, int snapshot);
+
+Map an index into memory, and check its header. Return it (and its size),
+or NULL if it doesn't exist or is empty. It's a fatal error if it isn't an
+index, or if it isn't a snapshot when snapshot is 1 (or is a snapshot when
+snapshot is 0). If snapshot is -1, it can be either.
+
+*/
+
+static char *index_map(const char *fname, size_t *size, int snapshot)
+{
+	struct stat statbuf[1];
+	char *index = NULL;
+	int fd;
+
+	if ((fd = open(fname, O_RDONLY)) == -1)
+	{
+		if (errno == ENOENT)
+			return NULL;
+
+		fatalsys("%s", ok(fname));
+	}
+
+	if (fstat(fd, statbuf) == -1)
+		fatalsys("%s", ok(fname));
+
+	if (!statbuf->st_size)
+	{
+		close(fd);
+
+		return NULL;
+	}
+
+	if (statbuf->st_size < sizeof(ihdr_t) || (index = mmap(NULL, statbuf->st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED || memcmp(index, INDEX_MAGIC, sizeof ((ihdr_t *)0)->magic))
+		fatal("%s: Not an index", ok(fname));
+
+	if (snapshot != -1 && ((ihdr_t *)index)->snapshot != snapshot)
+		fatal("%s: %s", ok(fname), (snapshot) ? "Not a snapshot" : "Not an index (it's a snapshot)");
+
+	close(fd);
+	*size = statbuf->st_size;
+
+	return index;
+}
+
+/*
+
+static idir_t *index_dir(dev_t dev, ino_t ino);
+
+Return the old index's hash slot for the directory with the given device
+and inode number (or an empty slot).
+
+*/
+
+static idir_t *index_dir(dev_t dev, ino_t ino)
+{
+	size_t i;
+	irec_t *rec;
+
+	for (i = point_hash(dev, ino) & (index_dirs_size - 1); index_dirs[i].rec; i = (i + 1) & (index_dirs_size - 1))
+	{
+		rec = (irec_t *)(index_old + index_dirs[i].rec);
+
+		if (rec->statbuf->st_dev == dev && rec->statbuf->st_ino == ino)
+			break;
+	}
+
+	return &index_dirs[i];
+}
+
+/*
+
+static void index_load(void);
+
+Load the old index (if there is one), and hash its directories, recording
+where each directory's descendants end.
+
+*/
+
+static void index_load(void)
+{
+	size_t pos, ndirs = 0, nstack = 0, stack_size = 0;
+	idir_t **stack = NULL, *slot;
+	irec_t *rec;
+
+	if (!(index_old = index_map(index_fname, &index_old_size, index_snapshot)))
+		return;
+
+	index_since = ((ihdr_t *)index_old)->start;
+
+	for (pos = sizeof(ihdr_t); pos < index_old_size; pos += IREC_SIZE(rec->len))
+		if (isdir((rec = index_rec(index_old, index_old_size, pos, index_fname))->statbuf))
+			++ndirs;
+
+	for (index_dirs_size = 1024; index_dirs_size < ndirs * 2; index_dirs_size *= 2)
+	{}
+
+	index_dirs = malloc_or_fatalsys(index_dirs_size * sizeof(idir_t));
+	memset(index_dirs, 0, index_dirs_size * sizeof(idir_t));
+
+	for (pos = sizeof(ihdr_t); pos < index_old_size; pos += IREC_SIZE(rec->len))
+	{
+		rec = (irec_t *)(index_old + pos);
+
+		/* The directories that this record isn't inside end here */
+
+		while (nstack && ((irec_t *)(index_old + stack[nstack - 1]->rec))->depth >= rec->depth)
+			stack[--nstack]->end = pos;
+
+		if (!isdir(rec->statbuf) || (slot = index_dir(rec->statbuf->st_dev, rec->statbuf->st_ino))->rec)
+			continue;
+
+		slot->rec = pos;
+
+		if (nstack == stack_size)
+			stack = realloc_or_fatalsys(stack, (stack_size = (stack_size) ? stack_size * 2 : 64) * sizeof(idir_t *));
+
+		stack[nstack++] = slot;
+	}
+
+	while (nstack)
+		stack[--nstack]->end = index_old_size;
+
+	free(stack);
+}
+
+/*
+
+static void index_cleanup(void);
+
+Remove the new index's temporary file if the search didn't finish.
+
+*/
+
+static void index_cleanup(void)
+{
+	if (index_tmpname)
+		unlink(index_tmpname);
+}
+
+/*
+
+void rawhide_index_open(char *fname, int snapshot);
+
+Prepare to write an index of the search to the given path (for the -Z
+option), or a snapshot if snapshot is non-zero (for the -C option). If it
+already exists, load it first.
+
+*/
+
+void rawhide_index_open(char *fname, int snapshot)
+{
+	struct stat statbuf[1];
+	ihdr_t hdr[1];
+	mode_t mask;
+	int fd;
+
+	index_fname = fname;
+	index_snapshot = snapshot;
+	index_load();
+
+	index_tmpname = malloc_or_fatalsys(strlen(fname) + 8);
+	snprintf(index_tmpname, strlen(fname) + 8, "%s.XXXXXX", fname);
+
+	if ((fd = mkstemp(index_tmpname)) == -1 || !(index_out = fdopen(fd, "w")))
+		fatalsys("%s", ok(index_tmpname));
+
+	/* Like any new file (mkstemp(3) creates it with mode 0600) */
+
+	umask(mask = umask(0));
+	fchmod(fd, 0666 & ~mask);
+	fcntl_set_fdflag(fd, FD_CLOEXEC);
+	atexit(index_cleanup);
+
+	/* The search starts now (according to the filesystem's clock, which might lag the system clock) */
+
+	if (fstat(fd, statbuf) == -1)
+		fatalsys("%s", ok(index_tmpname));
+
+	memset(hdr, 0, sizeof(ihdr_t));
+	memcpy(hdr->magic, INDEX_MAGIC, sizeof hdr->magic);
+	hdr->snapshot = snapshot;
+	hdr->start = CTIME(statbuf);
+
+	if (fwrite(hdr, sizeof(ihdr_t), 1, index_out) != 1)
+		fatalsys("%s", ok(index_tmpname));
+}
+
+/*
+
+void rawhide_index_close(void);
+
+Finish writing the new index, and replace the old one with it.
+
+*/
+
+void rawhide_index_close(void)
+{
+	if (!index_out)
+		return;
+
+	if (fclose(index_out) == EOF)
+		fatalsys("%s", ok(index_tmpname));
+
+	index_out = NULL;
+
+	if (rename(index_tmpname, index_fname) == -1)
+		fatalsys("rename %s %s", ok(index_tmpname), ok2(index_fname));
+
+	free(index_tmpname);
+	index_tmpname = NULL;
+
+	if (index_old)
+		munmap(index_old, index_old_size);
+
+	free(index_dirs);
+	index_old = NULL;
+	index_dirs = NULL;
+}
+
+/*
+
+static void index_write(char *basename);
+
+Write a record for the current entry to the new index. The basename
+parameter is as for rawhide_traverse().
+
+*/
+
+static void index_write(char *basename)
+{
+	static char padding[8];
+	char *name = (basename) ? basename : attr.fpath;
+	irec_t rec;
+	size_t len;
+
+	memset(&rec, 0, sizeof(irec_t));
+	rec.depth = attr.depth;
+	rec.len = len = strlen(name);
+	rec.followed = attr.followed;
+	*rec.statbuf = *attr.statbuf;
+
+	if (fwrite(&rec, sizeof(irec_t), 1, index_out) != 1 || fwrite(name, len, 1, index_out) != 1 || fwrite(padding, IREC_SIZE(len) - sizeof(irec_t) - len, 1, index_out) != 1)
+		fatalsys("%s", ok(index_tmpname));
+}
+
+/*
+
+static idir_t *index_unchanged(void);
+
+If the current entry (a directory) hasn't changed since the old index was
+written, return its hash slot. Otherwise, return NULL. A directory that
+changed after the search that wrote the old index started might have
+changed after it was read, even if its timestamps are the same, because
+they only have the resolution of the filesystem's clock.
+
+*/
+
+static idir_t *index_unchanged(void)
+{
+	idir_t *dir;
+	irec_t *rec;
+
+	if (!index_old || !(dir = index_dir(attr.statbuf->st_dev, attr.statbuf->st_ino))->rec)
+		return NULL;
+
+	rec = (irec_t *)(index_old + dir->rec);
+
+	if (MTIME(rec->statbuf) != MTIME(attr.statbuf) || CTIME(rec->statbuf) != CTIME(attr.statbuf) || CTIME(attr.statbuf) >= index_since)
+		return NULL;
+
+	debug(("index: %s unchanged", attr.fpath));
+
+	return dir;
+}
+
+/*
+
+static rhdirent_t *index_readdir(idir_t *dir, size_t *pos);
+
+Like rawhide_readdir(), but return the next entry of an unchanged directory
+from the old index. The pos parameter is the offset of the next record
+(initially the directory's own record). Non-directories' stat(2)
+information is used by the next rawhide_stat() (see index_stat()), unless
+it's a snapshot (-C), where every entry is statted, to notice files that
+were modified in place.
+
+*/
+
+static rhdirent_t *index_readdir(idir_t *dir, size_t *pos)
+{
+	irec_t *rec, *parent = (irec_t *)(index_old + dir->rec);
+	idir_t *subdir;
+
+	/* Skip the directory itself, or the previous entry and any descendants */
+
+	if (*pos == dir->rec)
+		*pos += IREC_SIZE(parent->len);
+	else if (isdir((rec = (irec_t *)(index_old + *pos))->statbuf) && (subdir = index_dir(rec->statbuf->st_dev, rec->statbuf->st_ino))->rec == *pos)
+		*pos = subdir->end;
+	else
+		for (*pos += IREC_SIZE(rec->len); *pos < dir->end && ((irec_t *)(index_old + *pos))->depth > parent->depth + 1; *pos += IREC_SIZE(((irec_t *)(index_old + *pos))->len))
+		{}
+
+	if (*pos >= dir->end)
+		return NULL;
+
+	rec = (irec_t *)(index_old + *pos);
+	index_entry->name = rec->name;
+	index_entry->ino = rec->statbuf->st_ino;
+	#ifdef IFTODT
+	index_entry->type = IFTODT(rec->statbuf->st_mode);
+	#else
+	index_entry->type = 0;
+	#endif
+	index_fetched = (isdir(rec->statbuf) || index_snapshot) ? NULL : rec;
+	batch_fetched = NULL;
+
+	return index_entry;
+}
+
+/*
+
+static int index_changed(void);
+
+Return whether or not the current entry should be reported: For -C, only
+entries that were created or changed since the old snapshot was written
+are reported.
+
+*/
+
+static int index_changed(void)
+{
+	return !index_snapshot || index_since == -1 || CTIME(attr.statbuf) >= index_since;
+}
+
+/*
+
+static int index_stat(void);
+
+If the current entry is a non-directory in an unchanged directory (see
+index_readdir()), take its stat(2) information from the old index, and
+return 1. Otherwise, return 0.
+
+*/
+
+static int index_stat(void)
+{
+	if (!index_fetched)
+		return 0;
+
+	*attr.statbuf = *index_fetched->statbuf;
+	attr.followed = (int)index_fetched->followed;
+	attr.stat_done = NEED_STAT;
+	index_fetched = NULL;
+
+	return 1;
+}
+
+/*
+
+Ignore files (-G)
+
+With -G, ignore files (like .gitignore) are read in each directory as it's
+searched, and a global ignore file can be supplied as well. Entries that
+their rules match aren't searched at all (i.e., they aren't tested or
+statted, and ignored directories aren't opened), so whole subtrees (e.g.,
+node_modules or .git) are skipped without reading them. The rules are
+matched using the directory entry's type, and the entry is only statted
+first if its type is unknown (or it's a symlink that would be followed),
+and a directory-only rule would make a difference.
+
+The rules are those of gitignore(5): blank lines and lines starting with
+"#" are skipped, "!" re-includes what an earlier rule ignored, a trailing
+"/" only matches directories, and patterns that contain any other "/" are
+matched against the path relative to the ignore file's directory (where
+"**" matches any number of directories). Other patterns are matched
+against the base name of entries at any depth below the ignore file. The
+last rule that matches wins, and the rules in deeper ignore files win over
+those in shallower ones (and the global ignore file, which applies to the
+search paths).
+
+Each ignore file's rules are compiled once, when it's read: base names
+without any wildcards are kept in a hash table (so most rules cost a
+single lookup), and only the remaining rules are matched one at a time,
+with fnmatch(3) or rhfnmatch(), most recent first, and only those more
+recent than any literal match.
+
+*/
+
+typedef struct ignrule_t ignrule_t;
+struct ignrule_t
+{
+	int negated;            /* Does it re-include (i.e., start with "!")? */
+	int dir_only;           /* Does it only match directories (i.e., end with "/")? */
+	int nsegs;              /* Number of path segments (or 0 to match base names) */
+	char **segs;            /* The path segments (or the base name pattern) */
+};
+
+typedef struct ignlit_t ignlit_t;
+struct ignlit_t
+{
+	const char *name;       /* The base name (NULL for an empty slot) */
+	int rule;               /* The last rule with this name (or -1) */
+	int dir_rule;           /* The last directory-only rule with this name (or -1) */
+};
+
+typedef struct ignore_t ignore_t;
+struct ignore_t
+{
+	ignore_t *next;         /* The ignore file for the directory above (or NULL) */
+	llong depth;            /* The depth of the entries in its directory */
+	int nrules;             /* Number of rules */
+	ignrule_t *rules;       /* The rules */
+	int nglobs;             /* Number of rules that aren't literal base names */
+	int *globs;             /* Their indexes (most recent first) */
+	size_t nlits;           /* Number of literal base name slots (power of 2, or 0) */
+	ignlit_t *lits;         /* The literal base names (hashed) */
+	char *text;             /* The ignore file's contents */
+};
+
+static char **ignore_names;                  /* The names of ignore files in each directory (-G) */
+static ignore_t *ignore_global;              /* The global ignore file's rules (-G) */
+static THREAD_LOCAL ignore_t *ignore_stack;  /* The ignore files of the directories being searched */
+static THREAD_LOCAL char *ignore_path;       /* The relative path being matched (split into components) */
+static THREAD_LOCAL size_t ignore_path_size; /* Its size */
+static THREAD_LOCAL char **ignore_comps;     /* Its components */
+static THREAD_LOCAL llong ignore_comps_size; /* Number of component slots */
+
+/*
+
+static size_t ignore_hash(const char *name);
+
+Return the hash (FNV-1a) of a base name (for the literal base names).
+
+*/
+
+static size_t ignore_hash(const char *name)
+{
+	size_t hash = (size_t)14695981039346656037ULL;
+
+	while (*name)
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= (size_t)1099511628211ULL;
+	}
+
+	return hash;
+}
+
+/*
+
+static ignore_t *ignore_compile(char *text, llong depth);
+
+Compile the rules in the contents of an ignore file, text, which is
+modified, and kept by the result. The depth parameter is the depth of the
+entries that the rules apply to.
+
+*/
+
+static ignore_t *ignore_compile(char *text, llong depth)
+{
+	ignore_t *ign = malloc_or_fatalsys(sizeof(ignore_t));
+	char *line, *next, *end, *s;
+	int i, alloc = 0, nlits = 0;
+	ignrule_t *rule;
+	ignlit_t *lit;
+
+	memset(ign, 0, sizeof(ignore_t));
+	ign->depth = depth;
+	ign->text = text;
+
+	for (line = text; line; line = next)
+	{
+		if ((next = strchr(line, '\n')))
+			*next++ = '\0';
+
+		/* Skip comments, and trailing carriage returns and (unescaped) spaces */
+
+		if (*line == '#')
+			continue;
+
+		for (end = line + strlen(line); end > line && (end[-1] == '\r' || (end[-1] == ' ' && (end - 1 == line || end[-2] != '\\'))); --end)
+		{}
+
+		*end = '\0';
+
+		if (ign->nrules == alloc)
+			ign->rules = realloc_or_fatalsys(ign->rules, (alloc = (alloc) ? alloc * 2 : 16) * sizeof(ignrule_t));
+
+		rule = &ign->rules[ign->nrules];
+		memset(rule, 0, sizeof(ignrule_t));
+
+		if ((rule->negated = (*line == '!')))
+			++line;
+
+		if ((rule->dir_only = (end > line && end[-1] == '/')))
+			*--end = '\0';
+
+		if (!*line)
+			continue;
+
+		/* Patterns that contain "/" are split into path segments (relative to the ignore file's directory) */
+
+		if (strchr(line, '/'))
+		{
+			if (*line == '/')
+				++line;
+
+			for (rule->nsegs = 1, s = line; *s; ++s)
+				if (*s == '/')
+					++rule->nsegs;
+
+			rule->segs = malloc_or_fatalsys(rule->nsegs * sizeof(char *));
+
+			for (i = 0, s = line; i < rule->nsegs; ++i)
+			{
+				rule->segs[i] = s;
+
+				if ((s = strchr(s, '/')))
+					*s++ = '\0';
+			}
+		}
+		else
+		{
+			rule->segs = malloc_or_fatalsys(sizeof(char *));
+			rule->segs[0] = line;
+
+			if (!strpbrk(line, "*?[\\"))
+				++nlits;
+		}
+
+		++ign->nrules;
+	}
+
+	/* Hash the literal base names, and list the other rules (most recent first) */
+
+	for (ign->nlits = (nlits) ? 4 : 0; ign->nlits && ign->nlits < nlits * 2; ign->nlits *= 2)
+	{}
+
+	if (ign->nlits)
+	{
+		ign->lits = malloc_or_fatalsys(ign->nlits * sizeof(ignlit_t));
+		memset(ign->lits, 0, ign->nlits * sizeof(ignlit_t));
+	}
+
+	ign->globs = malloc_or_fatalsys((ign->nrules + 1) * sizeof(int));
+
+	for (i = ign->nrules - 1; i >= 0; --i)
+	{
+		rule = &ign->rules[i];
+
+		if (rule->nsegs || strpbrk(rule->segs[0], "*?[\\"))
+		{
+			ign->globs[ign->nglobs++] = i;
+
+			continue;
+		}
+
+		for (lit = &ign->lits[ignore_hash(rule->segs[0]) & (ign->nlits - 1)]; lit->name && strcmp(lit->name, rule->segs[0]); lit = (lit == &ign->lits[ign->nlits - 1]) ? ign->lits : lit + 1)
+		{}
+
+		if (!lit->name)
+		{
+			lit->name = rule->segs[0];
+			lit->rule = lit->dir_rule = -1;
+		}
+
+		if (rule->dir_only && lit->dir_rule == -1)
+			lit->dir_rule = i;
+		else if (!rule->dir_only && lit->rule == -1)
+			lit->rule = i;
+	}
+
+	return ign;
+}
+
+/*
+
+static void ignore_free(ignore_t *ign);
+
+Deallocate an ignore file's rules.
+
+*/
+
+static void ignore_free(ignore_t *ign)
+{
+	int i;
+
+	for (i = 0; i < ign->nrules; ++i)
+		free(ign->rules[i].segs);
+
+	free(ign->rules);
+	free(ign->globs);
+	free(ign->lits);
+	free(ign->text);
+	free(ign);
+}
+
+/*
+
+static char *ignore_read(int dir_fd, const char *name);
+
+Return the contents of the ignore file with the given name (relative to
+dir_fd), or NULL if it doesn't exist (or can't be read).
+
+*/
+
+static char *ignore_read(int dir_fd, const char *name)
+{
+	size_t len = 0, size = 4096;
+	char *text;
+	ssize_t bytes;
+	int fd;
+
+	if ((fd = openat(dir_fd, name, O_RDONLY)) == -1)
+		return NULL;
+
+	text = malloc_or_fatalsys(size);
+
+	while ((bytes = read(fd, text + len, size - len - 1)) > 0)
+		if ((len += bytes) == size - 1)
+			text = realloc_or_fatalsys(text, size *= 2);
+
+	close(fd);
+
+	if (bytes == -1)
+	{
+		free(text);
+
+		return NULL;
+	}
+
+	text[len] = '\0';
+
+	return text;
+}
+
+/*
+
+void rawhide_ignore_init(char *names);
+
+Prepare to read ignore files (for the -G option). The names parameter is
+a comma-separated list of the names of the ignore files to read in each
+directory (e.g., ".gitignore,.ignore"), and the paths of any global ignore
+files (i.e., containing "/").
+
+*/
+
+void rawhide_ignore_init(char *names)
+{
+	ignore_t *ign;
+	char *name, *text;
+	int n = 0;
+
+	ignore_names = malloc_or_fatalsys((strlen(names) / 2 + 2) * sizeof(char *));
+
+	for (name = strtok(names, ","); name; name = strtok(NULL, ","))
+	{
+		if (!strchr(name, '/'))
+		{
+			ignore_names[n++] = name;
+
+			continue;
+		}
+
+		if (!(text = ignore_read(AT_FDCWD, name)))
+			fatalsys("%s", ok(name));
+
+		ign = ignore_compile(text, 1);
+		ign->next = ignore_global;
+		ignore_global = ign;
+	}
+
+	ignore_names[n] = NULL;
+
+	if (!n)
+	{
+		free(ignore_names);
+		ignore_names = NULL;
+	}
+}
+
+/*
+
+static void ignore_push(int dir_fd);
+
+Read and compile the ignore files (if any) in the directory that is about
+to be searched, dir_fd, whose entries are at depth attr.depth (for -G).
+
+*/
+
+static void ignore_push(int dir_fd)
+{
+	ignore_t *ign;
+	char *text;
+	int i;
+
+	for (i = 0; ignore_names[i]; ++i)
+	{
+		if (!(text = ignore_read(dir_fd, ignore_names[i])))
+			continue;
+
+		debug(("ignore file %s%s", attr.fpath, ignore_names[i]));
+
+		ign = ignore_compile(text, attr.depth);
+		ign->next = ignore_stack;
+		ignore_stack = ign;
+	}
+}
+
+/*
+
+static void ignore_pop(void);
+
+Finish with the ignore files (if any) in the directory whose entries are
+at depth attr.depth (for -G).
+
+*/
+
+static void ignore_pop(void)
+{
+	ignore_t *ign;
+
+	while ((ign = ignore_stack) && ign->depth == attr.depth)
+	{
+		ignore_stack = ign->next;
+		ignore_free(ign);
+	}
+}
+
+/*
+
+static llong ignore_split(const char *name);
+
+Split the path (relative to the search path) of the entry with the given
+base name, in the directory being searched, into its components (in
+ignore_comps), and return how many there are. The directory's path is taken
+from attr.fpath, which ends with either the entry's base name, or some
+other entry's base name (when reading a batch of entries), or a "/".
+
+*/
+
+static llong ignore_split(const char *name)
+{
+	char *s = attr.fpath + attr.search_path_len, *slash;
+	size_t dirlen, len;
+	llong n;
+
+	while (*s == '/')
+		++s;
+
+	dirlen = (slash = strrchr(s, '/')) ? slash + 1 - s : 0;
+
+	if ((len = dirlen + strlen(name) + 1) > ignore_path_size)
+		ignore_path = realloc_or_fatalsys(ignore_path, ignore_path_size = len * 2);
+
+	if (attr.depth > ignore_comps_size)
+		ignore_comps = realloc_or_fatalsys(ignore_comps, (ignore_comps_size = attr.depth * 2) * sizeof(char *));
+
+	memcpy(ignore_path, s, dirlen);
+	strcpy(ignore_path + dirlen, name);
+
+	for (n = 0, s = ignore_path; s && n < attr.depth; ++n)
+	{
+		ignore_comps[n] = s;
+
+		if ((s = strchr(s, '/')))
+			*s++ = '\0';
+	}
+
+	return n;
+}
+
+/*
+
+static int ignore_segs_match(char **segs, int nsegs, char **comps, llong ncomps);
+
+Return whether or not the path segment patterns, segs, match the path
+components, comps. A "**" segment matches any number of components (but
+at least one at the end).
+
+*/
+
+static int ignore_segs_match(char **segs, int nsegs, char **comps, llong ncomps)
+{
+	llong i;
+
+	for (; nsegs && strcmp(*segs, "**"); ++segs, --nsegs, ++comps, --ncomps)
+		if (!ncomps || attr.fnmatch(*segs, *comps, 0))
+			return 0;
+
+	if (!nsegs)
+		return !ncomps;
+
+	for (i = (nsegs == 1) ? 1 : 0; i <= ncomps; ++i)
+		if (ignore_segs_match(segs + 1, nsegs - 1, comps + i, ncomps - i))
+			return 1;
+
+	return 0;
+}
+
+/*
+
+static int ignore_match(ignore_t *ign, const char *basename, int dir, llong *ncomps);
+
+Return the index of the last rule in ign that matches the current entry
+(with the given base name, and whether or not it's a directory), or -1.
+The current entry's path is split into components when first needed (when
+*ncomps is -1).
+
+*/
+
+static int ignore_match(ignore_t *ign, const char *basename, int dir, llong *ncomps)
+{
+	ignrule_t *rule;
+	ignlit_t *lit;
+	int best = -1, i, r;
+	llong skip;
+
+	if (ign->nlits)
+	{
+		for (lit = &ign->lits[ignore_hash(basename) & (ign->nlits - 1)]; lit->name && strcmp(lit->name, basename); lit = (lit == &ign->lits[ign->nlits - 1]) ? ign->lits : lit + 1)
+		{}
+
+		if (lit->name)
+			best = (dir && lit->dir_rule > lit->rule) ? lit->dir_rule : lit->rule;
+	}
+
+	for (i = 0; i < ign->nglobs && (r = ign->globs[i]) > best; ++i)
+	{
+		if ((rule = &ign->rules[r])->dir_only && !dir)
+			continue;
+
+		if (!rule->nsegs)
+		{
+			if (attr.fnmatch(rule->segs[0], basename, 0) == 0)
+				return r;
+
+			continue;
+		}
+
+		if (*ncomps == -1)
+			*ncomps = ignore_split(basename);
+
+		if ((skip = ign->depth - 1) < *ncomps && ignore_segs_match(rule->segs, rule->nsegs, ignore_comps + skip, *ncomps - skip))
+			return r;
+	}
+
+	return best;
+}
+
+/*
+
+static int ignore_isdir(int type);
+
+Return whether or not an entry with the given directory entry type (DT_*)
+is a directory (or will be treated as one), or -1 if that's not known
+without statting it.
+
+*/
+
+static int ignore_isdir(int type)
+{
+	#ifdef DTTOIF
+	if (type != DT_UNKNOWN && !(type == DT_LNK && following_symlinks()))
+		return type == DT_DIR;
+	#endif
+
+	return -1;
+}
+
+/*
+
+static int ignored(const char *name, int dir);
+
+Return whether or not the entry with the given base name, in the directory
+being searched, is ignored by the rules in the ignore files (for -G). The
+dir parameter is whether or not it's a directory. If that's not known
+(-1), and it makes a difference (i.e., a directory-only rule matches),
+return -1.
+
+*/
+
+static int ignored(const char *name, int dir)
+{
+	llong ncomps = -1;
+	ignore_t *ign;
+	int rc, rule;
+
+	if (dir == -1)
+		return ((rc = ignored(name, 0)) == ignored(name, 1)) ? rc : -1;
+
+	for (ign = ignore_stack; ign; ign = ign->next)
+		if ((rule = ignore_match(ign, name, dir, &ncomps)) != -1)
+			return !ign->rules[rule].negated;
+
+	for (ign = ignore_global; ign; ign = ign->next)
+		if ((rule = ignore_match(ign, name, dir, &ncomps)) != -1)
+			return !ign->rules[rule].negated;
+
+	return 0;
+}
+
+/*
+
+Checkpoints (-k) and resuming (-R)
+
+With -k, the search position is written to a checkpoint file whenever an
+entry (including all of its descendants) has been searched, or a directory
+is about to be searched, and at least RAWHIDE_CHECKPOINT_INTERVAL seconds
+(default 60) have passed since the last checkpoint. The position is the
+index of the current search path, the device, inode number, and name of
+each directory that is being searched (from the search path down), and the
+name of the entry that was just finished (if any). The checkpoint file is
+removed when the search is finished.
+
+So that a position still means the same thing when the search is
+resumed, each directory's entries are searched in name order while
+checkpointing, rather than in directory order (which can change when
+entries are added or removed).
+
+With -R, the search resumes from the checkpoint's position (if there is a
+checkpoint file). Earlier search paths are skipped. In the directories
+that were being searched, the entries up to and including the recorded
+names are skipped, except for the directories that were being searched,
+which are searched again without being tested again (unless -D), so the
+entries that were already reported aren't reported again (except for any
+that were reported after the last checkpoint). If one of
+those directories has been replaced (i.e., it has a different device or
+inode number), it's searched and tested from the start.
+
+*/
+
+#define CHECKPOINT_MAGIC "rawhide checkpoint 1\n"
+
+typedef struct cplevel_t cplevel_t;
+struct cplevel_t
+{
+	dev_t dev;              /* The directory's device number */
+	ino_t ino;              /* The directory's inode number */
+	char *name;             /* Its name (the search path at depth 0, or the finished entry at the end) */
+};
+
+static char *checkpoint_fname;     /* The checkpoint file's path (-k) */
+static char *checkpoint_tmpname;   /* The new checkpoint's temporary path */
+static int checkpoint_interval;    /* Minimum number of seconds between checkpoints */
+static time_t checkpoint_last;     /* When the last checkpoint was written */
+static int checkpoint_path_index = -1; /* The index of the current search path */
+static int resume_path_index = -1; /* The checkpoint's search path index (-R), or -1 */
+static cplevel_t *resume_levels;   /* The checkpoint's directories (and finished entry) */
+static llong resume_count = -1;    /* The number of directories (-1 at the start of the search path) */
+static llong resume_depth = -1;    /* The depth of the directory being resumed, or -1 */
+static int resume_entering;        /* Is the next entry to be searched a directory to resume? */
+
+/*
+
+static void checkpoint_cleanup(void);
+
+Remove the temporary checkpoint file at exit (if any).
+
+*/
+
+static void checkpoint_cleanup(void)
+{
+	if (checkpoint_tmpname && *checkpoint_tmpname)
+		unlink(checkpoint_tmpname);
+}
+
+/*
+
+static void checkpoint_load(void);
+
+Load the checkpoint file for -R (if it exists). It's a fatal error if it
+isn't a checkpoint, or if it's corrupt.
+
+*/
+
+static void checkpoint_load(void)
+{
+	unsigned long long dev, ino;
+	char magic[sizeof CHECKPOINT_MAGIC];
+	llong depth;
+	size_t len;
+	FILE *in;
+
+	if (!(in = fopen(checkpoint_fname, "r")))
+	{
+		if (errno == ENOENT)
+			return;
+
+		fatalsys("%s", ok(checkpoint_fname));
+	}
+
+	if (!fgets(magic, sizeof magic, in) || strcmp(magic, CHECKPOINT_MAGIC))
+		fatal("%s: Not a checkpoint", ok(checkpoint_fname));
+
+	if (fscanf(in, "%d %lld", &resume_path_index, &resume_count) != 2 || fgetc(in) != '\n' || resume_path_index < 0 || resume_count < -1 || resume_count > attr.depth_limit)
+		fatal("%s: Corrupt checkpoint", ok(checkpoint_fname));
+
+	resume_levels = malloc_or_fatalsys((resume_count + 1) * sizeof(cplevel_t));
+
+	for (depth = 0; depth <= resume_count; ++depth)
+	{
+		if (depth < resume_count && fscanf(in, "%llu %llu", &dev, &ino) != 2)
+			fatal("%s: Corrupt checkpoint", ok(checkpoint_fname));
+
+		if (fscanf(in, "%zu:", &len) != 1 || len > 65536)
+			fatal("%s: Corrupt checkpoint", ok(checkpoint_fname));
+
+		resume_levels[depth].dev = (depth < resume_count) ? (dev_t)dev : 0;
+		resume_levels[depth].ino = (depth < resume_count) ? (ino_t)ino : 0;
+		resume_levels[depth].name = malloc_or_fatalsys(len + 1);
+
+		if (fread(resume_levels[depth].name, 1, len, in) != len || fgetc(in) != '\n')
+			fatal("%s: Corrupt checkpoint", ok(checkpoint_fname));
+
+		resume_levels[depth].name[len] = '\0';
+	}
+
+	fclose(in);
+}
+
+/*
+
+void rawhide_checkpoint_open(char *fname, int resume);
+
+Prepare to write checkpoints of the search position to the given path
+(for the -k option). If resume is non-zero (for the -R option), load the
+old checkpoint first (if it exists), and resume the search from there.
+
+*/
+
+void rawhide_checkpoint_open(char *fname, int resume)
+{
+	checkpoint_fname = fname;
+	checkpoint_interval = env_int("RAWHIDE_CHECKPOINT_INTERVAL", 0, INT_MAX, 60);
+	checkpoint_last = time(NULL);
+	attr.name_order = 1;
+
+	if (resume)
+		checkpoint_load();
+
+	checkpoint_tmpname = malloc_or_fatalsys(strlen(fname) + 8);
+	*checkpoint_tmpname = '\0';
+	atexit(checkpoint_cleanup);
+}
+
+/*
+
+void rawhide_checkpoint_close(void);
+
+The search is finished, so remove the checkpoint file.
+
+*/
+
+void rawhide_checkpoint_close(void)
+{
+	llong depth;
+
+	if (!checkpoint_fname)
+		return;
+
+	if (unlink(checkpoint_fname) == -1 && errno != ENOENT)
+		errorsys("%s", ok(checkpoint_fname));
+
+	checkpoint_fname = NULL;
+	free(checkpoint_tmpname);
+	checkpoint_tmpname = NULL;
+
+	for (depth = 0; resume_levels && depth <= resume_count; ++depth)
+		free(resume_levels[depth].name);
+
+	free(resume_levels);
+	resume_levels = NULL;
+}
+
+/*
+
+static void checkpoint_write(int path_index, llong depth);
+
+Write a new checkpoint file that replaces the old one (so there's always a
+complete checkpoint). The position is in the search path with the given
+index, and the current entry (attr.fpath), at the given depth, has just
+been searched (or if attr.fpath ends with "/", the directory at depth - 1
+is about to be searched). If depth is -1, the position is the start of the
+search path. Standard output is flushed first, so that everything reported
+before the checkpoint has been written.
+
+*/
+
+static void checkpoint_write(int path_index, llong depth)
+{
+	char *name = attr.fpath, *end = attr.fpath + attr.search_path_len;
+	llong level;
+	mode_t mask;
+	FILE *out;
+	int fd;
+
+	fflush(stdout);
+
+	snprintf(checkpoint_tmpname, strlen(checkpoint_fname) + 8, "%s.XXXXXX", checkpoint_fname);
+
+	if ((fd = mkstemp(checkpoint_tmpname)) == -1 || !(out = fdopen(fd, "w")))
+		fatalsys("%s", ok(checkpoint_tmpname));
+
+	/* Like any new file (mkstemp(3) creates it with mode 0600) */
+
+	umask(mask = umask(0));
+	fchmod(fd, 0666 & ~mask);
+
+	fprintf(out, "%s%d %lld\n", CHECKPOINT_MAGIC, path_index, depth);
+
+	/* The directories being searched (and their entries' names), then the finished entry */
+
+	for (level = 0; level <= depth; ++level)
+	{
+		if (level)
+		{
+			for (name = end; *name == '/'; ++name)
+			{}
+
+			if (!(end = strchr(name, '/')))
+				end = name + strlen(name);
+		}
+
+		if (level < depth)
+			fprintf(out, "%llu %llu ", (unsigned long long)attr.search_stack[level].dev, (unsigned long long)attr.search_stack[level].ino);
+
+		fprintf(out, "%zu:", (size_t)(end - name));
+		fwrite(name, 1, end - name, out);
+		fputc('\n', out);
+	}
+
+	if (ferror(out) || fclose(out) == EOF)
+		fatalsys("%s", ok(checkpoint_tmpname));
+
+	if (rename(checkpoint_tmpname, checkpoint_fname) == -1)
+		fatalsys("rename %s %s", ok(checkpoint_tmpname), ok2(checkpoint_fname));
+
+	*checkpoint_tmpname = '\0';
+	checkpoint_last = time(NULL);
+}
+
+/*
+
+static void checkpoint_entry(void);
+
+The current entry (and its descendants, if any) has been searched (for
+-k). Stop resuming (if resuming), and write a checkpoint (if it's time).
+
+*/
+
+static void checkpoint_entry(void)
+{
+	resume_depth = -1;
+	resume_entering = 0;
+
+	if (time(NULL) - checkpoint_last >= checkpoint_interval)
+		checkpoint_write(checkpoint_path_index, attr.depth);
+}
+
+/*
+
+static void checkpoint_dir(void);
+
+The current entry is a directory that is about to be searched (for -k),
+so it's already been tested (unless -D). Write a checkpoint with none of
+its entries finished yet (if it's time, and it's not being resumed).
+
+*/
+
+static void checkpoint_dir(void)
+{
+	if (resume_depth == -1 && time(NULL) - checkpoint_last >= checkpoint_interval)
+		checkpoint_write(checkpoint_path_index, attr.depth);
+}
+
+/*
+
+static int checkpoint_path(const char *fpath);
+
+Start searching the next search path, fpath, with -k. Returns whether or
+not it was already searched (for -R), and should be skipped. Otherwise,
+if the checkpoint is in this search path, prepare to resume it.
+
+*/
+
+static int checkpoint_path(const char *fpath)
+{
+	++checkpoint_path_index;
+
+	if (checkpoint_path_index < resume_path_index)
+		return 1;
+
+	if (checkpoint_path_index == resume_path_index && resume_count != -1)
+	{
+		if (strcmp(fpath, resume_levels[0].name))
+			fatal("%s: Checkpoint is for a different search path: %s", ok(checkpoint_fname), ok2(resume_levels[0].name));
+
+		resume_entering = 1;
+	}
+
+	return 0;
+}
+
+/*
+
+static void checkpoint_path_done(void);
+
+The current search path has been searched (for -k). Stop resuming (if
+resuming), and record the start of the next search path as the position
+(if it's time for a checkpoint).
+
+*/
+
+static void checkpoint_path_done(void)
+{
+	resume_depth = -1;
+	resume_entering = 0;
+
+	if (time(NULL) - checkpoint_last >= checkpoint_interval)
+		checkpoint_write(checkpoint_path_index + 1, -1);
+}
+
+/*
+
+static int resume_skip(const char *name);
+
+When resuming the search of the directory at depth attr.depth - 1 (for
+-R), return whether or not its entry with the given name was already
+searched (and should be skipped). If it's the directory that was being
+searched, prepare to resume it. Otherwise, if it comes after the
+checkpoint's position, stop resuming.
+
+*/
+
+static int resume_skip(const char *name)
+{
+	int cmp = strcmp(name, resume_levels[attr.depth].name);
+
+	if (cmp < 0)
+		return 1;
+
+	if (cmp == 0 && attr.depth < resume_count)
+	{
+		resume_entering = 1;
+
+		return 0;
+	}
+
+	resume_depth = -1;
+
+	return cmp == 0;
+}
+
+/*
+
+static int resume_enter(void);
+
+The current entry has the name of the directory that was being searched
+at this depth (for -R). If it's still the same directory, start resuming
+its search, and return 1 (so that it isn't tested again). Otherwise, stop
+resuming, and return 0.
+
+*/
+
+static int resume_enter(void)
+{
+	cplevel_t *level = &resume_levels[attr.depth];
+
+	resume_entering = 0;
+
+	if (isdir(attr.statbuf) && attr.statbuf->st_dev == level->dev && attr.statbuf->st_ino == level->ino)
+	{
+		resume_depth = attr.depth;
+
+		return 1;
+	}
+
+	resume_depth = -1;
+
+	return 0;
+}
+
+/*
+
+Watching (-w)
+
+With -w, every directory that is searched is also watched for changes with
+inotify(7) on Linux. After the search, rawhide_watch() waits for changes in
+the watched directories, and tests the entries that changed: new entries
+(and everything in new directories, which are then watched as well), and
+entries that were written or had their attributes changed.
+
+*/
+
+static int watch_fd = -1;          /* The inotify file descriptor (for -w) */
+static int watch_current = -1;     /* Watch descriptor of the directory being searched */
+
+#ifdef HAVE_INOTIFY
+
+#define WATCH_EVENTS (IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CLOSE_WRITE | IN_ATTRIB | IN_ONLYDIR)
+
+typedef struct watch_t watch_t;
+struct watch_t
+{
+	char *path;             /* The directory's path */
+	llong depth;            /* Its depth */
+	dev_t dev;              /* Its device number */
+	ino_t ino;              /* Its inode number */
+	int parent;             /* Its parent directory's watch descriptor (-1 if none) */
+	char *search_path;      /* The search path that it's in */
+	dev_t fs_dev;           /* The search path's filesystem (for -1) */
+};
+
+static int watch_cwd_fd = -1;      /* The initial current directory (shell commands change it) */
+static watch_t **watches;          /* The watched directories (indexed by watch descriptor) */
+static int watches_size;           /* Number of watch descriptor slots */
+static int watches_count;          /* Number of watched directories */
+
+#endif
+
+/*
+
+void rawhide_watch_init(void);
+
+Prepare to watch the directories that are searched for changes (for the
+-w option). It's a fatal error if that isn't possible on this system.
+
+*/
+
+void rawhide_watch_init(void)
+{
+	#ifdef HAVE_INOTIFY
+	if ((watch_fd = inotify_init1(IN_CLOEXEC)) == -1)
+		fatalsys("inotify_init1");
+
+	if ((watch_cwd_fd = open(".", O_RDONLY)) == -1)
+		fatalsys("open .");
+
+	fcntl_set_fdflag(watch_cwd_fd, FD_CLOEXEC);
+	#else
+	fatal("-w option isn't available here (needs inotify)");
+	#endif
+}
+
+/*
+
+static void watch_add(int dir_fd);
+
+Watch the directory being searched (attr.fpath, open as dir_fd) for
+changes, and make it the parent of any directories watched beneath it.
+
+*/
+
+static void watch_add(int dir_fd)
+{
+	#ifdef HAVE_INOTIFY
+	char proc_path[64];
+	watch_t *w;
+	int wd;
+
+	/* Watch it via its file descriptor (its path might be relative or too long) */
+
+	snprintf(proc_path, sizeof proc_path, "/proc/self/fd/%d", dir_fd);
+
+	if ((wd = inotify_add_watch(watch_fd, proc_path, WATCH_EVENTS)) == -1)
+	{
+		if (errno == ENOSPC)
+			error("%s: Too many watches (see /proc/sys/fs/inotify/max_user_watches)", ok(attr.fpath));
+		else
+			errorsys("inotify_add_watch %s", ok(attr.fpath));
+
+		watch_current = -1;
+
+		return;
+	}
+
+	if (wd >= watches_size)
+	{
+		int old_size = watches_size;
+
+		while (wd >= watches_size)
+			watches_size = (watches_size) ? watches_size * 2 : 1024;
+
+		watches = realloc_or_fatalsys(watches, watches_size * sizeof(watch_t *));
+		memset(watches + old_size, 0, (watches_size - old_size) * sizeof(watch_t *));
+	}
+
+	/* The same directory might have been watched via another path */
+
+	if (!(w = watches[wd]))
+	{
+		w = watches[wd] = malloc_or_fatalsys(sizeof(watch_t));
+		++watches_count;
+	}
+	else
+		free(w->path);
+
+	debug(("watch %s (wd %d)", attr.fpath, wd));
+
+	w->path = malloc_or_fatalsys(strlen(attr.fpath) + 1);
+	strcpy(w->path, attr.fpath);
+	w->depth = attr.depth;
+	w->dev = attr.statbuf->st_dev;
+	w->ino = attr.statbuf->st_ino;
+	w->parent = (wd == watch_current) ? -1 : watch_current;
+	w->search_path = attr.search_path;
+	w->fs_dev = attr.fs_dev;
+	watch_current = wd;
+	#else
+	(void)dir_fd;
+	#endif
+}
+
+static int rawhide_traverse_dir(size_t nul_posi, int parent_fd, char *basename);
+
+/*
+
+static void rawhide_traverse(size_t nul_posi, int parent_fd, char *basename);
+
+Traverse the directory tree, evaluating search criteria, and calling the
+visit function, for each match.
+
+The nul_posi parameter is the offset to the nul byte at the end of attr.fpath.
+There can be a trailing "/" before nul_posi (but usually not).
+
+The parent_fd parameter is a file descriptor for the current entry's parent
+directory.
+
+The basename parameter points to the current entry's base name (often with a
+trailing "/") within attr.fpath.
+
+The parent_fd and basename parameters are used with openat() to minimize
+race conditions. When called by rawhide_search() they are AT_FDCWD and NULL.
+
+*/
+
+static int rawhide_traverse(size_t nul_posi, int parent_fd, char *basename)
+{
+	struct stat save_statbuf[1];
+	int save_followed = 0, save_dirent_type = 0, save_stat_done = 0;
+	ino_t save_dirent_ino = 0;
+	size_t basename_posi = (basename) ? basename - attr.fpath : 0;
+	int rc = 0, dir_rc, resumed = 0, statted = 0;
+
+	debug(("rawhide_traverse(fpath=%s, offset=%d, parent_fd=%d, basename=%s, depth=%d)", attr.fpath, (int)nul_posi, parent_fd, (basename) ? basename : "N/A", attr.depth));
+
+	/* Check the depth (Can't happen: depth <= max_depth always) */
+
+	if (attr.depth > attr.max_depth)
+	{
+		/* If we've reached the system limit that's an error */
+
+		if (attr.depth > attr.depth_limit)
+			return error("too many directory levels: %s", ok(attr.fpath));
+
+		return 0;
+	}
+
+	/* Don't search ignored entries at all (for -G), or even stat them (unless it's needed to know if they're directories) */
+
+	if ((ignore_stack || ignore_global) && basename)
+	{
+		int ignore = ignored(basename, ignore_isdir(attr.dirent_type));
+
+		if (ignore == -1)
+		{
+			if (rawhide_stat(parent_fd, basename) == -1)
+				return -1;
+
+			statted = 1;
+			ignore = ignored(basename, isdir(attr.statbuf));
+		}
+
+		if (ignore)
+		{
+			debug(("skipping %s: Ignored", attr.fpath));
+
+			return 0;
+		}
+	}
+
+	/* Prepare for this entry (fstatat) */
+
+	if (!statted && rawhide_stat(parent_fd, basename) == -1)
+		return -1;
+
+	/* Add this entry to the index (for -Z) */
+
+	if (index_out)
+		index_write(basename);
+
+	/* Resume searching this directory where the checkpoint left off (for -R) */
+
+	if (resume_entering)
+		resumed = resume_enter();
+
+	/* Test this entry and respond (if not searching depth-first, and it wasn't tested before the checkpoint) */
+
+	if (!attr.depth_first && !resumed)
+		rawhide_evaluate(parent_fd, basename);
+	else
+	{
+		*save_statbuf = *attr.statbuf;
+		save_followed = attr.followed;
+		save_stat_done = attr.stat_done & ~NEED_BTIME; /* The saved btime is overwritten */
+		save_dirent_type = attr.dirent_type;
+		save_dirent_ino = attr.dirent_ino;
+	}
+
+	/* Record the filesystem device number at the start, for single-filesystem traversal */
+
+	if (attr.single_filesystem && parent_fd == AT_FDCWD)
+		attr.fs_dev = attr.statbuf->st_dev;
+
+	/* If it's a directory, process its entries */
+
+	if (rawhide_descending())
+	{
+		/* Not too deep */
+
+		if (attr.depth == attr.depth_limit)
+			return error("too many directory levels: %s", ok(attr.fpath));
+
+		/* Check for filesystem cycles (symlinks, or even hard links on OpenVMS or macOS Time Machine backups) */
+
+		if (search_stack_contains(attr.statbuf->st_dev, attr.statbuf->st_ino))
+		{
+			if (attr.report_cycles)
+				error("skipping %s: Filesystem cycle detected", ok(attr.fpath));
+
+			return 0; /* This is not an error */
+		}
+
+		/* Don't search a directory again via a symlink (for -YY) */
+
+		if (rawhide_revisiting())
+			return 0;
+
+		/* Search its entries */
+
+		if ((dir_rc = rawhide_traverse_dir(nul_posi, parent_fd, basename)) == -2)
+			return -1;
+
+		if (dir_rc == -1)
+			rc = -1;
+	}
+
+	/* Test this entry and respond (if searching depth-first) */
+
+	if (attr.depth_first)
+	{
+		*attr.statbuf = *save_statbuf;
+		attr.followed = save_followed;
+		attr.stat_done = save_stat_done;
+		attr.dirent_type = save_dirent_type;
+		attr.dirent_ino = save_dirent_ino;
+
+		/* The parent directory might have been closed (and attr.fpath reallocated) while searching this one */
+
+		if (basename)
+			basename = attr.fpath + basename_posi;
+
+		if (attr.fd_window && attr.depth > levels_base && (parent_fd = level_fd(attr.depth - 1 - levels_base)) == -1)
+			return -1;
+
+		rawhide_evaluate(parent_fd, basename);
+	}
+
+	/* Don't prune siblings */
+
+	attr.prune = 0;
+
+	return rc;
+}
+
+/*
+
+static int rawhide_traverse_dir(size_t nul_posi, int parent_fd, char *basename);
+
+Search the entries of the current entry (a directory) with
+rawhide_traverse(). The parameters are the same as for rawhide_traverse().
+Returns 0 on success, or -1 if there were errors with any of its entries.
+If the directory couldn't be opened, returns -2 (after reporting it).
+
+*/
+
+static int rawhide_traverse_dir(size_t nul_posi, int parent_fd, char *basename)
+{
+	int dir_fd;
+	rhdir_t *dir = NULL;
+	rhdirent_t *entry;
+	size_t remaining, post_slash_nul_posi, len, index_pos = 0;
+	size_t basename_posi = (basename) ? basename - attr.fpath : 0;
+	char *name = (parent_fd == AT_FDCWD) ? attr.fpath : basename;
+	idir_t *unchanged = index_unchanged();
+	int save_watch_current = watch_current;
+	int rc = 0;
+
+	/* Open the directory as a file descriptor to minimize race conditions */
+
+	debug(("openat(parent_fd=%d, path=%s)", parent_fd, name));
+
+	if (attr.test_openat_failure)
+		errno = EPERM;
+
+	if (attr.test_openat_failure || (dir_fd = openat(parent_fd, name, O_RDONLY)) == -1)
+	{
+		errorsys("%s", ok(attr.fpath));
+
+		return -2;
+	}
+
+	debug(("openat: dir_fd %d", dir_fd));
+
+	/* Prevent leaking this file descriptor into child processes */
+
+	fcntl_set_fdflag(dir_fd, FD_CLOEXEC);
+
+	/* Open the directory as a DIR to enumerate its entries */
+
+	debug(("fdopendir(dir_fd=%d)", dir_fd));
+
+	if (attr.test_fdopendir_failure)
+		errno = EPERM;
+
+	if (attr.test_fdopendir_failure || !(dir = rawhide_opendir(dir_fd)))
+	{
+		close(dir_fd);
+		errorsys("fdopendir %s", ok(attr.fpath));
+
+		return -2;
+	}
+
+	/* Watch the directory for changes (for -w) */
+
+	if (watch_fd != -1)
+		watch_add(dir_fd);
+
+	/* Let any prefetch threads run ahead into its subdirectories */
+
+	if (!unchanged)
+		prefetch_push(attr.fpath);
+
+	/* Ensure that there's a trailing "/" */
+
+	post_slash_nul_posi = nul_posi;
+
+	if (attr.fpath[post_slash_nul_posi - 1] != '/')
+	{
+		if (post_slash_nul_posi + 1 >= attr.fpath_size)
+		{
+			/* This shouldn't happen (unless we've crossed a filesystem boundary) */
+
+			attr.fpath = realloc_or_fatalsys(attr.fpath, attr.fpath_size *= 2);
+		}
+
+		attr.fpath[post_slash_nul_posi++] = '/';
+		attr.fpath[post_slash_nul_posi] = '\0';
+	}
+
+	remaining = attr.fpath_size - post_slash_nul_posi;
+
+	/* Descend into the directory */
+
+	search_stack_push();
+
+	if (attr.fd_window)
+		level_enter(dir, basename_posi, nul_posi);
+
+	attr.depth += 1;
+
+	/* Read its ignore files (for -G) */
+
+	if (ignore_names)
+		ignore_push(dir_fd);
+
+	/* Record the search position (for -k) */
+
+	if (checkpoint_fname)
+		checkpoint_dir();
+
+	/* Apply recursively to this directory's entries (or those in the old index if unchanged, for -Z) */
+
+	if (unchanged)
+		index_pos = unchanged->rec;
+
+	while ((entry = (unchanged) ? index_readdir(unchanged, &index_pos) : rawhide_readdir_batch(dir)))
+	{
+		/* Skip the entries that were searched before the checkpoint (for -R) */
+
+		if (resume_depth == attr.depth - 1 && resume_skip(entry->name))
+			continue;
+
+		if ((len = strlcpy(attr.fpath + post_slash_nul_posi, entry->name, remaining)) >= remaining)
+		{
+			/* This shouldn't happen (unless we've crossed a filesystem boundary) */
+
+			#define max(a, b) ((a) > (b) ? (a) : (b))
+			size_t new_fpath_size = max(attr.fpath_size * 2, post_slash_nul_posi + len + 1);
+			#undef max
+			attr.fpath = realloc_or_fatalsys(attr.fpath, new_fpath_size);
+			attr.fpath_size = new_fpath_size;
+			remaining = attr.fpath_size - post_slash_nul_posi;
+			strlcpy(attr.fpath + post_slash_nul_posi, entry->name, remaining);
+		}
+
+		debug(("dir entry %s", attr.fpath));
+
+		attr.dirent_type = entry->type;
+		attr.dirent_ino = entry->ino;
+
+		/* The directory might have been closed while searching a previous entry */
+
+		if (attr.fd_window && (dir_fd = level_fd(attr.depth - 1 - levels_base)) == -1)
+		{
+			rc = -1;
+			break;
+		}
+
+		if (rawhide_traverse(post_slash_nul_posi + len, (dir_fd == -1) ? AT_FDCWD : dir_fd, attr.fpath + post_slash_nul_posi) == -1)
+			rc = -1;
+
+		index_fetched = NULL;
+
+		/* Record the search position (for -k) */
+
+		if (checkpoint_fname)
+			checkpoint_entry();
+	}
+
+	if (attr.fd_window)
+		level_exit(attr.depth - 1 - levels_base);
+
+	rawhide_closedir(dir);
+
+	if (ignore_names)
+		ignore_pop();
+
+	/* Ascend from the directory */
+
+	attr.depth -= 1;
+	search_stack_pop();
+	watch_current = save_watch_current;
+
+	/* Remove the trailing slash and directory entry name */
+
+	attr.fpath[nul_posi] = '\0';
+
+	return rc;
+}
+
+/*
+
+Breadth-first traversal (-W)
+
+The directories to be read are kept in a FIFO queue. Reading a directory
+tests all of its entries, and queues its subdirectories, so entries are
+tested in order of depth (shallowest first). Each queued directory is a
+bnode_t that only contains its own name and a (reference counted) pointer
+to its parent, so the queue's memory use depends on the number of
+directories, not the length of their paths. The full path is rebuilt in
+attr.fpath when the directory is read.
+
+Queued directories aren't kept open (there could be very many of them), so
+they are opened with their full path (or relative to their parent if the
+path is too long), and their device and inode number are checked, so that
+a directory that was renamed or replaced in the meantime isn't mistaken
+for the original.
+
+If queueing a directory would take the queue's memory use over
+RAWHIDE_BFS_MEMORY bytes (default 64MiB), it's searched depth-first
+immediately instead (with rawhide_traverse_dir()).
+
+*/
+
+typedef struct bnode_t bnode_t;
+struct bnode_t
+{
+	bnode_t *parent;        /* The parent directory (NULL for the search path) */
+	bnode_t *next;          /* The next directory in the queue */
+	llong refs;             /* One for the queue, plus one for each child */
+	llong depth;            /* Relative depth of this directory */
+	dev_t dev;              /* Device number (to check when reopening, and for cycle detection) */
+	ino_t ino;              /* Inode number (to check when reopening, and for cycle detection) */
+	int followed;           /* Did we follow a symlink to this directory? */
+	size_t len;             /* Length of the name */
+	char name[];            /* Name of this directory (the whole path for the search path) */
+};
+
+static THREAD_LOCAL bnode_t *bfs_head;   /* The first directory in the queue */
+static THREAD_LOCAL bnode_t *bfs_tail;   /* The last directory in the queue */
+static THREAD_LOCAL size_t bfs_memory;   /* Memory used by the queued directories and their ancestors */
+static THREAD_LOCAL bnode_t *bfs_cache_node; /* An open parent directory (for paths that are too long) */
+static THREAD_LOCAL int bfs_cache_fd = -1;   /* The open parent directory's file descriptor */
+
+/*
+
+static void bfs_release(bnode_t *node);
+
+Finish with a directory in the queue, or one of its subdirectories. When
+nothing refers to it anymore, deallocate it, and finish with it in its
+parent directory as well.
+
+*/
+
+static void bfs_release(bnode_t *node)
+{
+	bnode_t *parent;
+
+	while (node && !--node->refs)
+	{
+		parent = node->parent;
+		bfs_memory -= sizeof(bnode_t) + node->len + 1;
+		free(node);
+		node = parent;
+	}
+}
+
+/*
+
+static size_t bfs_fpath(bnode_t *node);
+
+Rebuild a queued directory's path in attr.fpath (growing it if needed),
+from the names of it and its ancestors. Returns the length of the path.
+
+*/
+
+static size_t bfs_fpath(bnode_t *node)
+{
+	size_t len, posi;
+	bnode_t *n;
+
+	for (len = 0, n = node; n; n = n->parent)
+		len += n->len + (n->parent && n->parent->name[n->parent->len - 1] != '/');
+
+	if (len + 2 > attr.fpath_size)
+		attr.fpath = realloc_or_fatalsys(attr.fpath, attr.fpath_size = len + 2);
+
+	attr.fpath[posi = len] = '\0';
+
+	for (n = node; n; n = n->parent)
+	{
+		memcpy(attr.fpath + (posi -= n->len), n->name, n->len);
+
+		if (n->parent && n->parent->name[n->parent->len - 1] != '/')
+			attr.fpath[--posi] = '/';
+	}
+
+	return len;
+}
+
+/*
+
+static void bfs_cache(bnode_t *node, int fd);
+
+Keep the directory, node, open as fd (for opening its subdirectories whose
+paths are too long to open directly), instead of the previous one (if any).
+With NULL and -1, just close the previous one.
+
+*/
+
+static void bfs_cache(bnode_t *node, int fd)
+{
+	if (bfs_cache_node)
+	{
+		close(bfs_cache_fd);
+		bfs_release(bfs_cache_node);
+	}
+
+	if ((bfs_cache_node = node))
+		++node->refs;
+
+	bfs_cache_fd = fd;
+}
+
+/*
+
+static int bfs_open(bnode_t *node, size_t nul_posi);
+
+Open the queued directory, node, whose path is in attr.fpath (up to
+nul_posi), and check that it's still the same directory. If the path is
+too long to open directly, open it relative to its parent (which is opened
+likewise, and kept open for its other subdirectories). On success, returns
+the file descriptor. On error, returns -1 with errno set by openat() or
+fstat(). If it's a different directory, returns -2.
+
+*/
+
+static int bfs_open(bnode_t *node, size_t nul_posi)
+{
+	int flags = O_RDONLY | O_DIRECTORY | ((node->followed) ? 0 : O_NOFOLLOW);
+	struct stat statbuf[1];
+	size_t parent_nul_posi;
+	int fd, parent_fd, save_errno;
+	char c;
+
+	debug(("bfs: openat(path=%s)", attr.fpath));
+
+	if ((fd = openat(AT_FDCWD, attr.fpath, flags)) == -1)
+	{
+		if (errno != ENAMETOOLONG || !node->parent)
+			return -1;
+
+		if (node->parent != bfs_cache_node)
+		{
+			parent_nul_posi = nul_posi - node->len - (node->parent->name[node->parent->len - 1] != '/');
+			c = attr.fpath[parent_nul_posi];
+			attr.fpath[parent_nul_posi] = '\0';
+			parent_fd = bfs_open(node->parent, parent_nul_posi);
+			attr.fpath[parent_nul_posi] = c;
+
+			if (parent_fd < 0)
+				return parent_fd;
+
+			bfs_cache(node->parent, parent_fd);
+		}
+
+		debug(("bfs: openat(parent_fd=%d, path=%s)", bfs_cache_fd, node->name));
+
+		if ((fd = openat(bfs_cache_fd, node->name, flags)) == -1)
+			return -1;
+	}
+
+	if (fstat(fd, statbuf) == -1)
+	{
+		save_errno = errno;
+		close(fd);
+		errno = save_errno;
+
+		return -1;
+	}
+
+	if (statbuf->st_dev != node->dev || statbuf->st_ino != node->ino)
+	{
+		close(fd);
+
+		return -2;
+	}
+
+	/* Prevent leaking this file descriptor into child processes */
+
+	fcntl_set_fdflag(fd, FD_CLOEXEC);
+
+	return fd;
+}
+
+/*
+
+static int bfs_entry(bnode_t *node, size_t nul_posi, int parent_fd, char *basename);
+
+Like rawhide_traverse(), but instead of recursing into a directory, queue
+it to be read later (or search it depth-first if the queue is full). The
+node parameter is the parent directory (NULL for the starting search path).
+
+*/
+
+static int bfs_entry(bnode_t *node, size_t nul_posi, int parent_fd, char *basename)
+{
+	bnode_t *child, *ancestor;
+	size_t len, size;
+	llong save_levels_base;
+	int rc = 0;
+
+	debug(("bfs: entry(fpath=%s, offset=%d, parent_fd=%d, basename=%s, depth=%d)", attr.fpath, (int)nul_posi, parent_fd, (basename) ? basename : "N/A", attr.depth));
+
+	/* Prepare for this entry (fstatat) */
+
+	if (rawhide_stat(parent_fd, basename) == -1)
+		return -1;
+
+	/* Test this entry and respond */
+
+	rawhide_evaluate(parent_fd, basename);
+
+	/* Record the filesystem device number at the start, for single-filesystem traversal */
+
+	if (attr.single_filesystem && !node)
+		attr.fs_dev = attr.statbuf->st_dev;
+
+	/* If it's a directory, queue it */
+
+	if (rawhide_descending())
+	{
+		/* Not too deep */
+
+		if (attr.depth == attr.depth_limit)
+			return error("too many directory levels: %s", ok(attr.fpath));
+
+		/* Check for filesystem cycles */
+
+		for (ancestor = node; ancestor; ancestor = ancestor->parent)
+		{
+			if (ancestor->dev == attr.statbuf->st_dev && ancestor->ino == attr.statbuf->st_ino)
+			{
+				if (attr.report_cycles)
+					error("skipping %s: Filesystem cycle detected", ok(attr.fpath));
+
+				attr.prune = 0;
+
+				return 0; /* This is not an error */
+			}
+		}
+
+		/* Don't search a directory again via a symlink (for -YY) */
+
+		if (rawhide_revisiting())
+		{
+			attr.prune = 0;
+
+			return 0;
+		}
+
+		len = (basename) ? nul_posi - (basename - attr.fpath) : nul_posi;
+		size = sizeof(bnode_t) + len + 1;
+
+		if (bfs_memory + size <= (size_t)attr.bfs_memory)
+		{
+			child = malloc_or_fatalsys(size);
+			child->parent = node;
+			child->next = NULL;
+			child->refs = 1;
+			child->depth = attr.depth;
+			child->dev = attr.statbuf->st_dev;
+			child->ino = attr.statbuf->st_ino;
+			child->followed = attr.followed;
+			child->len = len;
+			memcpy(child->name, attr.fpath + nul_posi - len, len + 1);
+			bfs_memory += size;
+
+			if (node)
+				++node->refs;
+
+			if (bfs_tail)
+				bfs_tail->next = child;
+			else
+				bfs_head = child;
+
+			bfs_tail = child;
+
+			debug(("bfs: queue %s", attr.fpath));
+		}
+		else
+		{
+			/* The queue is full, so search this directory depth-first now (with its ancestors on the search stack) */
+
+			debug(("bfs: search %s depth-first", attr.fpath));
+
+			search_stack_grow(attr.depth);
+
+			for (ancestor = node; ancestor; ancestor = ancestor->parent)
+			{
+				attr.search_stack[ancestor->depth].dev = ancestor->dev;
+				attr.search_stack[ancestor->depth].ino = ancestor->ino;
+			}
+
+			search_stack_rehash(attr.depth);
+			save_levels_base = levels_base;
+			levels_base = attr.depth;
+
+			if (rawhide_traverse_dir(nul_posi, parent_fd, basename) != 0)
+				rc = -1;
+
+			levels_base = save_levels_base;
+		}
+	}
+
+	/* Don't prune siblings */
+
+	attr.prune = 0;
+
+	return rc;
+}
+
+/*
+
+static int bfs_list(bnode_t *node);
+
+Read a queued directory, and process its entries with bfs_entry().
+Returns 0 on success, or -1 if there were any errors.
+
+*/
+
+static int bfs_list(bnode_t *node)
+{
+	size_t nul_posi, post_slash_nul_posi, remaining, len;
+	rhdir_t *dir;
+	rhdirent_t *entry;
+	int dir_fd, rc = 0;
+
+	nul_posi = bfs_fpath(node);
+
+	/* Open the directory (checking that it's still the same one) */
+
+	if (attr.test_openat_failure)
+		errno = EPERM;
+
+	if (attr.test_openat_failure || (dir_fd = bfs_open(node, nul_posi)) == -1)
+		return errorsys("%s", ok(attr.fpath));
+
+	if (dir_fd == -2)
+		return error("%s: Directory replaced during the search", ok(attr.fpath));
+
+	/* Open the directory as a DIR to enumerate its entries */
+
+	if (attr.test_fdopendir_failure)
+		errno = EPERM;
+
+	if (attr.test_fdopendir_failure || !(dir = rawhide_opendir(dir_fd)))
+	{
+		close(dir_fd);
+
+		return errorsys("fdopendir %s", ok(attr.fpath));
+	}
+
+	/* Ensure that there's a trailing "/" */
+
+	post_slash_nul_posi = nul_posi;
+
+	if (attr.fpath[post_slash_nul_posi - 1] != '/')
+	{
+		attr.fpath[post_slash_nul_posi++] = '/';
+		attr.fpath[post_slash_nul_posi] = '\0';
+	}
+
+	remaining = attr.fpath_size - post_slash_nul_posi;
+
+	/* Process this directory's entries */
+
+	attr.depth = node->depth + 1;
+
+	while ((entry = rawhide_readdir_batch(dir)))
+	{
+		if ((len = strlcpy(attr.fpath + post_slash_nul_posi, entry->name, remaining)) >= remaining)
+		{
+			#define max(a, b) ((a) > (b) ? (a) : (b))
+			size_t new_fpath_size = max(attr.fpath_size * 2, post_slash_nul_posi + len + 1);
+			#undef max
+			attr.fpath = realloc_or_fatalsys(attr.fpath, new_fpath_size);
+			attr.fpath_size = new_fpath_size;
+			remaining = attr.fpath_size - post_slash_nul_posi;
+			strlcpy(attr.fpath + post_slash_nul_posi, entry->name, remaining);
+		}
+
+		debug(("dir entry %s", attr.fpath));
+
+		attr.dirent_type = entry->type;
+		attr.dirent_ino = entry->ino;
+
+		if (bfs_entry(node, post_slash_nul_posi + len, dir_fd, attr.fpath + post_slash_nul_posi) == -1)
+			rc = -1;
+	}
+
+	rawhide_closedir(dir);
+
+	return rc;
+}
+
+/*
+
+static int bfs_search(size_t nul_posi);
+
+Search breadth-first (for -W), starting with the search path in attr.fpath.
+Returns 0 on success, or -1 if there were any errors.
+
+*/
+
+static int bfs_search(size_t nul_posi)
+{
+	bnode_t *node;
+	int rc;
+
+	rc = bfs_entry(NULL, nul_posi, AT_FDCWD, NULL);
+
+	while ((node = bfs_head))
+	{
+		if (!(bfs_head = node->next))
+			bfs_tail = NULL;
+
+		if (bfs_list(node) == -1)
+			rc = -1;
+
+		bfs_release(node);
+	}
+
+	bfs_cache(NULL, -1);
+
+	return rc;
+}
+
+/*
+
+Parallel traversal (-P)
+
+Each directory to be read is a pnode_t. The worker threads each have a
+deque of them. A worker pushes the subdirectories that it finds onto the
+bottom of its own deque, and pops from the bottom as well (so it searches
+depth-first, like rawhide_traverse()). When its own deque is empty, it
+steals from the top of another worker's deque (i.e., the shallowest, and
+probably largest, subtrees).
+
+Each worker has its own attr (copied from the main thread), Stack, SP, PC,
+and FP. Visits (output and actions), shell commands (which chdir), and
+shared lazy state (e.g., reference files) are serialized with
+rawhide_lock(). The main thread's attr holds the -l column widths and the
+exit status that are shared between workers.
+
+A directory stays open until all of its subdirectories have been read
+(they are opened relative to it with openat()). For -D, that's also when
+the directory itself is tested.
+
+*/
+
+typedef struct pnode_t pnode_t;
+struct pnode_t
+{
+	pnode_t *parent;        /* The parent directory (open while this is pending) */
+	int fd;                 /* This directory (open while its subdirectories are pending) */
+	llong pending;          /* Reading this directory, plus each pending subdirectory */
+	llong depth;            /* Relative depth of this directory */
+	struct stat statbuf[1]; /* Stat info of this directory (for -D and cycle detection) */
+	int followed;           /* Did we follow a symlink to this directory? */
+	int stat_done;          /* What statbuf contains (NEED_* bits, except btime) */
+	int dirent_type;        /* File type from the parent directory entry */
+	ino_t dirent_ino;       /* Inode number from the parent directory entry */
+	size_t nul_posi;        /* Length of the path */
+	size_t base_posi;       /* Offset of the base name within the path (0 for the search path) */
+	char fpath[];           /* Path to this directory */
+};
+
+typedef struct pworker_t pworker_t;
+struct pworker_t
+{
+	pthread_t thread;       /* The worker thread */
+	int id;                 /* Index into par_workers */
+	pthread_mutex_t lock;   /* Protects the deque */
+	pnode_t **deque;        /* Directories to read (owner at the bottom, thieves at the top) */
+	size_t top;             /* Index of the top of the deque */
+	size_t bottom;          /* Index after the bottom of the deque */
+	size_t size;            /* Allocated size of the deque */
+};
+
+static pworker_t *par_workers;            /* The worker threads */
+static int par_nworkers;                  /* The number of worker threads */
+static runtime_t *par_attr;               /* The main thread's attr (for shared state) */
+static pthread_mutex_t par_lock;          /* Serializes visits, commands, and shared lazy state */
+static pthread_mutex_t par_tree_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects pnode_t pending counts */
+static pthread_mutex_t par_idle_lock = PTHREAD_MUTEX_INITIALIZER; /* Protects par_queued and par_active */
+static pthread_cond_t par_idle_cond = PTHREAD_COND_INITIALIZER;   /* Signals new work or completion */
+static llong par_queued;                  /* Number of directories in all of the deques */
+static llong par_active;                  /* Number of directories queued or being read */
+static THREAD_LOCAL pworker_t *par_self;  /* This worker thread (NULL in the main thread) */
+
+/*
+
+void rawhide_lock(void);
+void rawhide_unlock(void);
+
+Serialize access to shared resources (the cwd, output, reference files,
+getpwuid()) between -P or -J threads. No-ops without -P or -J.
+
+*/
+
+void rawhide_lock(void)
+{
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_lock(&par_lock);
+}
+
+void rawhide_unlock(void)
+{
+	if (attr.parallel > 1 || attr.path_threads > 1)
+		pthread_mutex_unlock(&par_lock);
+}
+
+/*
+
+static void par_columns(runtime_t *dst, const runtime_t *src);
+
+Copy the -l column widths so far (they are shared by -P worker threads).
+
+*/
+
+static void par_columns(runtime_t *dst, const runtime_t *src)
+{
+	dst->column_width_init_done = src->column_width_init_done;
+	dst->dev_major_column_width = src->dev_major_column_width;
+	dst->dev_minor_column_width = src->dev_minor_column_width;
+	dst->ino_column_width = src->ino_column_width;
+	dst->blksize_column_width = src->blksize_column_width;
+	dst->blocks_column_width = src->blocks_column_width;
+	dst->space_column_width = src->space_column_width;
+	dst->nlink_column_width = src->nlink_column_width;
+	dst->user_column_width = src->user_column_width;
+	dst->group_column_width = src->group_column_width;
+	dst->size_column_width = src->size_column_width;
+	dst->rdev_major_column_width = src->rdev_major_column_width;
+	dst->rdev_minor_column_width = src->rdev_minor_column_width;
+}
+
+/*
+
+static void par_status(void);
+
+Record a worker thread's failure exit status in the main thread's attr.
+
+*/
+
+static void par_status(void)
+{
+	if (attr.exit_status == EXIT_SUCCESS)
+		return;
+
+	pthread_mutex_lock(&par_lock);
+	par_attr->exit_status = attr.exit_status;
+	pthread_mutex_unlock(&par_lock);
+}
+
+/*
+
+static void rawhide_visit(void);
+
+Call the visit function for the current (matching) entry. With -P or -J,
+threads take turns (and share the -l column widths).
+
+*/
+
+static void rawhide_visit(void)
+{
+	if (!par_self)
+	{
+		(*(attr.visitf))();
+
+		return;
+	}
+
+	pthread_mutex_lock(&par_lock);
+	par_columns(&attr, par_attr);
+	(*(attr.visitf))();
+	par_columns(par_attr, &attr);
+	pthread_mutex_unlock(&par_lock);
+}
+
+/*
+
+static void rawhide_exit(void);
+
+Exit early (the exit built-in). With -P or -J, a thread keeps the lock
+so that no other thread produces any more output, and the exit status
+includes failures in the other threads.
+
+*/
+
+static void rawhide_exit(void)
+{
+	if (par_self)
+	{
+		pthread_mutex_lock(&par_lock);
+
+		if (attr.exit_status == EXIT_SUCCESS)
+			attr.exit_status = par_attr->exit_status;
+	}
+
+	exit(attr.exit_status);
+}
+
+/*
+
+static void par_push(pnode_t *node);
+
+Push a directory onto the bottom of the current worker's deque (or the
+first worker's deque, if called by the main thread), and wake up an idle
+worker to steal it.
+
+*/
+
+static void par_push(pnode_t *node)
+{
+	pworker_t *w = (par_self) ? par_self : par_workers;
+
+	pthread_mutex_lock(&w->lock);
+
+	if (w->bottom == w->size && w->top)
+	{
+		memmove(w->deque, w->deque + w->top, (w->bottom - w->top) * sizeof(*w->deque));
+		w->bottom -= w->top;
+		w->top = 0;
+	}
+
+	if (w->bottom == w->size)
+		w->deque = realloc_or_fatalsys(w->deque, (w->size = (w->size) ? w->size * 2 : 64) * sizeof(*w->deque));
+
+	w->deque[w->bottom++] = node;
+
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_mutex_lock(&par_idle_lock);
+	++par_queued;
+	++par_active;
+	pthread_cond_signal(&par_idle_cond);
+	pthread_mutex_unlock(&par_idle_lock);
+}
+
+/*
+
+static pnode_t *par_take(pworker_t *w, int steal);
+
+Pop a directory from the bottom of a worker's own deque, or steal one from
+the top of another worker's deque. Returns NULL if it's empty.
+
+*/
+
+static pnode_t *par_take(pworker_t *w, int steal)
+{
+	pnode_t *node = NULL;
+
+	pthread_mutex_lock(&w->lock);
+
+	if (w->top < w->bottom)
+		node = (steal) ? w->deque[w->top++] : w->deque[--w->bottom];
+
+	if (w->top == w->bottom)
+		w->top = w->bottom = 0;
+
+	pthread_mutex_unlock(&w->lock);
+
+	if (node)
+	{
+		pthread_mutex_lock(&par_idle_lock);
+		--par_queued;
+		pthread_mutex_unlock(&par_idle_lock);
+	}
+
+	return node;
+}
+
+/*
+
+static void par_fpath(pnode_t *node);
+
+Copy a directory's path into this thread's attr.fpath (growing it if needed).
+
+*/
+
+static void par_fpath(pnode_t *node)
+{
+	if (node->nul_posi + 2 > attr.fpath_size)
+		attr.fpath = realloc_or_fatalsys(attr.fpath, attr.fpath_size = node->nul_posi + 2);
+
+	memcpy(attr.fpath, node->fpath, node->nul_posi + 1);
+}
+
+/*
+
+static void par_release(pnode_t *node);
+
+Finish with a directory's listing or one of its subdirectories. When
+nothing is pending, test the directory (if searching depth-first), close
+it, and finish with it in its parent directory as well.
+
+*/
+
+static void par_release(pnode_t *node)
+{
+	pnode_t *parent;
+	llong pending;
+
+	while (node)
+	{
+		pthread_mutex_lock(&par_tree_lock);
+		pending = --node->pending;
+		pthread_mutex_unlock(&par_tree_lock);
+
+		if (pending)
+			return;
+
+		/* Test this directory and respond (if searching depth-first) */
+
+		if (attr.depth_first)
+		{
+			par_fpath(node);
+			*attr.statbuf = *node->statbuf;
+			attr.followed = node->followed;
+			attr.stat_done = node->stat_done;
+			attr.dirent_type = node->dirent_type;
+			attr.dirent_ino = node->dirent_ino;
+			attr.depth = node->depth;
+			rawhide_evaluate((node->parent) ? node->parent->fd : AT_FDCWD, (node->parent) ? attr.fpath + node->base_posi : NULL);
+			attr.prune = 0;
+		}
+
+		debug(("parallel: done %s", node->fpath));
+
+		if (node->fd != -1)
+			close(node->fd);
+
+		parent = node->parent;
+		free(node);
+		node = parent;
+	}
+}
+
+/*
+
+static int par_entry(pnode_t *node, size_t nul_posi, int parent_fd, char *basename);
+
+Like rawhide_traverse(), but instead of recursing into a directory, queue
+it to be read by any worker thread. The node parameter is the parent
+directory (NULL for the starting search path).
+
+*/
+
+static int par_entry(pnode_t *node, size_t nul_posi, int parent_fd, char *basename)
+{
+	pnode_t *child, *ancestor;
+
+	debug(("parallel: entry(fpath=%s, offset=%d, parent_fd=%d, basename=%s, depth=%d)", attr.fpath, (int)nul_posi, parent_fd, (basename) ? basename : "N/A", attr.depth));
+
+	/* Prepare for this entry (fstatat) */
+
+	if (rawhide_stat(parent_fd, basename) == -1)
+		return -1;
+
+	/* Test this entry and respond (if not searching depth-first) */
+
+	if (!attr.depth_first)
+		rawhide_evaluate(parent_fd, basename);
+
+	/* Record the filesystem device number at the start, for single-filesystem traversal */
+
+	if (attr.single_filesystem && !node)
+		attr.fs_dev = attr.statbuf->st_dev;
+
+	/* If it's a directory, queue it */
+
+	if (rawhide_descending())
+	{
+		/* Not too deep */
+
+		if (attr.depth == attr.depth_limit)
+			return error("too many directory levels: %s", ok(attr.fpath));
+
+		/* Check for filesystem cycles */
+
+		for (ancestor = node; ancestor; ancestor = ancestor->parent)
+		{
+			if (ancestor->statbuf->st_dev == attr.statbuf->st_dev && ancestor->statbuf->st_ino == attr.statbuf->st_ino)
+			{
+				if (attr.report_cycles)
+					error("skipping %s: Filesystem cycle detected", ok(attr.fpath));
+
+				attr.prune = 0;
+
+				return 0; /* This is not an error */
+			}
+		}
+
+		/* Don't search a directory again via a symlink (for -YY) */
+
+		if (rawhide_revisiting())
+		{
+			attr.prune = 0;
+
+			return 0;
+		}
+
+		child = malloc_or_fatalsys(sizeof(pnode_t) + nul_posi + 1);
+		child->parent = node;
+		child->fd = -1;
+		child->pending = 1;
+		child->depth = attr.depth;
+		*child->statbuf = *attr.statbuf;
+		child->followed = attr.followed;
+		child->stat_done = attr.stat_done & ~NEED_BTIME;
+		child->dirent_type = attr.dirent_type;
+		child->dirent_ino = attr.dirent_ino;
+		child->nul_posi = nul_posi;
+		child->base_posi = (basename) ? basename - attr.fpath : 0;
+		memcpy(child->fpath, attr.fpath, nul_posi + 1);
+
+		if (node)
+		{
+			pthread_mutex_lock(&par_tree_lock);
+			++node->pending;
+			pthread_mutex_unlock(&par_tree_lock);
+		}
+
+		debug(("parallel: queue %s", child->fpath));
+		par_push(child);
+	}
+
+	/* Test this entry and respond (if searching depth-first and not queued) */
+
+	else if (attr.depth_first)
+		rawhide_evaluate(parent_fd, basename);
+
+	/* Don't prune siblings */
+
+	attr.prune = 0;
+
+	return 0;
+}
+
+/*
+
+static void par_list(pnode_t *node);
+
+Read a queued directory, and process its entries with par_entry().
+
+*/
+
+static void par_list(pnode_t *node)
+{
+	int parent_fd = (node->parent) ? node->parent->fd : AT_FDCWD;
+	size_t post_slash_nul_posi, remaining, len;
+	rhdir_t *dir;
+	rhdirent_t *entry;
+	int dir_fd, dup_fd = -1;
+	char *name;
+
+	par_fpath(node);
+	name = (node->parent) ? attr.fpath + node->base_posi : attr.fpath;
+
+	/* Open the directory as a file descriptor to minimize race conditions */
+
+	debug(("parallel: worker %d openat(parent_fd=%d, path=%s)", par_self->id, parent_fd, name));
+
+	if (attr.test_openat_failure)
+		errno = EPERM;
+
+	if (attr.test_openat_failure || (dir_fd = openat(parent_fd, name, O_RDONLY)) == -1)
+	{
+		errorsys("%s", ok(attr.fpath));
+		attr.exit_status = EXIT_FAILURE;
+		par_release(node);
+
+		return;
+	}
+
+	/* Prevent leaking this file descriptor into child processes */
+
+	fcntl_set_fdflag(dir_fd, FD_CLOEXEC);
+
+	/* Open a duplicate as a directory stream to enumerate its entries */
+	/* (dir_fd stays open for its subdirectories, but the buffer doesn't) */
+
+	if (attr.test_fdopendir_failure)
+		errno = EPERM;
+
+	if (attr.test_fdopendir_failure || (dup_fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0)) == -1 || !(dir = rawhide_opendir(dup_fd)))
+	{
+		if (dup_fd != -1)
+			close(dup_fd);
+		close(dir_fd);
+		errorsys("fdopendir %s", ok(attr.fpath));
+		attr.exit_status = EXIT_FAILURE;
+		par_release(node);
+
+		return;
+	}
+
+	/* Ensure that there's a trailing "/" */
+
+	post_slash_nul_posi = node->nul_posi;
+
+	if (attr.fpath[post_slash_nul_posi - 1] != '/')
+	{
+		attr.fpath[post_slash_nul_posi++] = '/';
+		attr.fpath[post_slash_nul_posi] = '\0';
+	}
+
+	remaining = attr.fpath_size - post_slash_nul_posi;
+
+	/* Process this directory's entries */
+
+	attr.depth = node->depth + 1;
+
+	node->fd = dir_fd;
+
+	while ((entry = rawhide_readdir_batch(dir)))
+	{
+		if ((len = strlcpy(attr.fpath + post_slash_nul_posi, entry->name, remaining)) >= remaining)
+		{
+			#define max(a, b) ((a) > (b) ? (a) : (b))
+			size_t new_fpath_size = max(attr.fpath_size * 2, post_slash_nul_posi + len + 1);
+			#undef max
+			attr.fpath = realloc_or_fatalsys(attr.fpath, new_fpath_size);
+			attr.fpath_size = new_fpath_size;
+			remaining = attr.fpath_size - post_slash_nul_posi;
+			strlcpy(attr.fpath + post_slash_nul_posi, entry->name, remaining);
+		}
+
+		debug(("dir entry %s", attr.fpath));
+
+		attr.dirent_type = entry->type;
+		attr.dirent_ino = entry->ino;
+
+		if (par_entry(node, post_slash_nul_posi + len, dir_fd, attr.fpath + post_slash_nul_posi) == -1)
+			attr.exit_status = EXIT_FAILURE;
+	}
+
+	rawhide_closedir(dir);
+	par_release(node);
+}
+
+static void runtime_buffers_free(void);
+
+/*
+
+static void par_thread_init(pworker_t *self);
+
+Prepare a -P or -J thread's runtime state (based on the main thread's),
+except for attr.fpath.
+
+*/
+
+static void par_thread_init(pworker_t *self)
+{
+	par_self = self;
+	pthread_mutex_lock(&par_lock);
+	attr = *par_attr;
+	pthread_mutex_unlock(&par_lock);
+	attr.fpath = NULL;
+	attr.defused_path = attr.defused_basename = NULL;
+	attr.defused_path_size = attr.defused_basename_size = 0;
+	attr.ftarget = attr.formatbuf = attr.fea = attr.fea_format = NULL;
+	attr.ttybuf = attr.ttybuf_sanitized = attr.body = NULL;
+	attr.body_size = 0;
+	attr.search_stack = NULL;
+	attr.search_stack_size = 0;
+	attr.search_hash = NULL;
+	attr.search_hash_size = 0;
+	#ifdef HAVE_MAGIC
+	attr.what_cookie = attr.mime_cookie = attr.what_follow_cookie = attr.mime_follow_cookie = NULL;
+	#endif
+	Stack = malloc_or_fatalsys((MAX_STACK_SIZE + 3) * sizeof(llong));
+}
+
+/*
+
+static void par_thread_free(void);
+
+Deallocate a -P or -J thread's runtime state, except for attr.fpath.
+
+*/
+
+static void par_thread_free(void)
+{
+	runtime_buffers_free();
+	free(attr.defused_path);
+	free(attr.defused_basename);
+	free(attr.search_stack);
+	free(attr.search_hash);
+
+	if (attr.user_shell_copy && attr.user_shell_copy != par_attr->user_shell_copy)
+		free(attr.user_shell_copy);
+
+	#ifdef HAVE_MAGIC
+	if (attr.what_cookie)
+		magic_close(attr.what_cookie);
+	if (attr.mime_cookie)
+		magic_close(attr.mime_cookie);
+	if (attr.what_follow_cookie)
+		magic_close(attr.what_follow_cookie);
+	if (attr.mime_follow_cookie)
+		magic_close(attr.mime_follow_cookie);
+	#endif
+
+	free(Stack);
+}
+
+/*
+
+static void par_lock_init(void);
+
+Initialize par_lock (once). It is recursive, just in case a visit needs
+shared lazy state.
+
+*/
+
+static void par_lock_init(void)
+{
+	static int par_lock_init_done = 0;
+	pthread_mutexattr_t lock_attr[1];
+
+	if (par_lock_init_done)
+		return;
+
+	pthread_mutexattr_init(lock_attr);
+	pthread_mutexattr_settype(lock_attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&par_lock, lock_attr);
+	pthread_mutexattr_destroy(lock_attr);
+	par_lock_init_done = 1;
+}
+
+/*
+
+static void *par_worker(void *arg);
+
+The -P worker thread: Read directories from its own deque, or steal them
+from other workers, until there are none left anywhere.
+
+*/
+
+static void *par_worker(void *arg)
+{
+	pnode_t *node;
+	int i, done = 0;
+
+	/* Prepare this thread's runtime state (based on the main thread's) */
+
+	par_thread_init((pworker_t *)arg);
+	attr.fpath = malloc_or_fatalsys(attr.fpath_size);
+
+	debug(("parallel: worker %d started", par_self->id));
+
+	while (!done)
+	{
+		/* Take from our own deque, or steal from another */
+
+		node = par_take(par_self, 0);
+
+		for (i = 1; !node && i < par_nworkers; ++i)
+			node = par_take(&par_workers[(par_self->id + i) % par_nworkers], 1);
+
+		if (node)
+		{
+			par_list(node);
+			par_status();
+
+			pthread_mutex_lock(&par_idle_lock);
+
+			if (--par_active == 0)
+				pthread_cond_broadcast(&par_idle_cond);
+
+			pthread_mutex_unlock(&par_idle_lock);
+
+			continue;
+		}
+
+		/* Wait for more work, or for everything to be done */
+
+		pthread_mutex_lock(&par_idle_lock);
+
+		while (!par_queued && par_active)
+			pthread_cond_wait(&par_idle_cond, &par_idle_lock);
+
+		done = !par_active;
+
+		pthread_mutex_unlock(&par_idle_lock);
+	}
+
+	debug(("parallel: worker %d finished", par_self->id));
+
+	/* Cleanup */
+
+	free(attr.fpath);
+	par_thread_free();
+
+	return NULL;
+}
+
+/*
+
+static int par_search(size_t nul_posi);
+
+Like rawhide_traverse() for the starting search path, but if it's a
+directory, search it with attr.parallel worker threads.
+
+*/
+
+static int par_search(size_t nul_posi)
+{
+	int rc, i, err;
+
+	par_lock_init();
+	par_attr = &attr;
+	par_nworkers = attr.parallel;
+	par_workers = malloc_or_fatalsys(par_nworkers * sizeof(pworker_t));
+	par_queued = par_active = 0;
+
+	for (i = 0; i < par_nworkers; ++i)
+	{
+		par_workers[i].id = i;
+		pthread_mutex_init(&par_workers[i].lock, NULL);
+		par_workers[i].deque = NULL;
+		par_workers[i].top = par_workers[i].bottom = par_workers[i].size = 0;
+	}
+
+	/* Test the starting search path (queueing it if it's a directory) */
+
+	rc = par_entry(NULL, nul_posi, AT_FDCWD, NULL);
+
+	/* Search it */
+
+	if (par_active)
+	{
+		for (i = 0; i < par_nworkers; ++i)
+			if ((err = pthread_create(&par_workers[i].thread, NULL, par_worker, &par_workers[i])))
+				errno = err, fatalsys("pthread_create");
+
+		for (i = 0; i < par_nworkers; ++i)
+			pthread_join(par_workers[i].thread, NULL);
+	}
+
+	/* Cleanup */
+
+	for (i = 0; i < par_nworkers; ++i)
+	{
+		pthread_mutex_destroy(&par_workers[i].lock);
+		free(par_workers[i].deque);
+	}
+
+	free(par_workers);
+	par_workers = NULL;
+
+	return rc;
+}
+
+/*
+
+Concurrent search paths (-J)
+
+Each search path is searched by one of up to attr.path_threads threads,
+with the usual sequential (or -W) traversal. When a thread finishes a
+search path, it takes the next one. The threads are set up like -P
+worker threads (they have their own attr, Stack, etc.), and their visits
+are serialized with par_lock, so output records from different search
+paths are never mixed together, but the order of the records varies.
+
+The open file limit (for the depth limit and RAWHIDE_FD_WINDOW) is
+divided between the threads (see main()).
+
+*/
+
+static char **paths_list;   /* The search paths */
+static int paths_count;     /* The number of search paths */
+static int paths_next;      /* Index of the next search path to search */
+static int paths_failed;    /* Did the search of any search path fail? */
+
+/*
+
+static void *paths_worker(void *arg);
+
+The -J thread: Search the next search path until there are none left.
+
+*/
+
+static void *paths_worker(void *arg)
+{
+	int i;
+
+	par_thread_init((pworker_t *)arg);
+
+	debug(("paths: thread %d started", par_self->id));
+
+	for (;;)
+	{
+		pthread_mutex_lock(&par_lock);
+		i = (paths_next < paths_count) ? paths_next++ : -1;
+		pthread_mutex_unlock(&par_lock);
+
+		if (i == -1)
+			break;
+
+		debug(("paths: thread %d searching %s", par_self->id, paths_list[i]));
+
+		if (rawhide_search(paths_list[i]) == -1)
+		{
+			pthread_mutex_lock(&par_lock);
+			paths_failed = 1;
+			pthread_mutex_unlock(&par_lock);
+		}
+
+		par_status();
+	}
+
+	debug(("paths: thread %d finished", par_self->id));
+
+	par_thread_free();
+
+	return NULL;
+}
+
+/*
+
+int rawhide_search_paths(char **paths, int npaths);
+
+Search multiple search paths concurrently, with up to attr.path_threads
+threads (for the -J option). Returns -1 if the search of any of them
+failed (like rawhide_search()), or 0 otherwise.
+
+*/
+
+int rawhide_search_paths(char **paths, int npaths)
+{
+	pthread_attr_t thread_attr[1];
+	pworker_t *threads;
+	int nthreads, i, err;
+
+	par_lock_init();
+	par_attr = &attr;
+	paths_list = paths;
+	paths_count = npaths;
+	paths_next = 0;
+	paths_failed = 0;
+
+	nthreads = (attr.path_threads < npaths) ? attr.path_threads : npaths;
+	threads = malloc_or_fatalsys(nthreads * sizeof(pworker_t));
+	memset(threads, 0, nthreads * sizeof(pworker_t));
+
+	/* Deep searches need more than the default thread stack size */
+
+	pthread_attr_init(thread_attr);
+
+	if (attr.thread_stack_size)
+		pthread_attr_setstacksize(thread_attr, attr.thread_stack_size);
+
+	for (i = 0; i < nthreads; ++i)
+	{
+		threads[i].id = i;
+
+		if ((err = pthread_create(&threads[i].thread, thread_attr, paths_worker, &threads[i])))
+			errno = err, fatalsys("pthread_create");
+	}
+
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(threads[i].thread, NULL);
+
+	pthread_attr_destroy(thread_attr);
+	free(threads);
+
+	return (paths_failed) ? -1 : 0;
+}
+
+/*
+
+llong env_int(char *envname, llong min_value, llong max_value, llong default);
+
+Get an integer from an environment variable. Check that it is within
+required limits. Ignore invalid values.
+
+*/
+
+llong env_int(char *envname, llong min_value, llong max_value, llong default_value)
+{
+	char *env, *endptr = NULL;
+	llong e;
+
+	if ((env = getenv(envname)) && *env)
+	{
+		errno = 0;
+		e = strtoll(env, &endptr, 10);
+
+		if ((endptr && !*endptr) && errno != ERANGE)
+			if ((min_value == -1 || e >= min_value) && (max_value == -1 || e <= max_value))
+				return e;
+	}
+
+	return default_value;
+}
+
+/*
+
+int rawhide_search(char *fpath);
+
+Search for filesystem entries that satisfy the search criteria.
+Initialize global attr runtime state, then call rawhide_traverse().
+The fpath parameter is the search path.
+
+*/
+
+int rawhide_search(char *fpath)
+{
+	llong max_pathlen;
+	char *slash_posp;
+	int rc = 0;
+	size_t len;
+
+	debug(("rawhide_search(fpath=%s)", fpath));
+
+	/* Remove any trailing slashes */
+
+	while ((slash_posp = strrchr(fpath, '/')) && !slash_posp[1] && slash_posp > fpath)
+		*slash_posp = '\0';
+
+	/* Skip it if it was searched before the checkpoint (for -R) */
+
+	if (checkpoint_fname && checkpoint_path(fpath))
+		return 0;
+
+	/* Determine the maximum path length on this filesystem */
+
+	max_pathlen = pathconf(fpath, _PC_PATH_MAX);
+	max_pathlen = (max_pathlen == -1) ? 1024 : max_pathlen + 2;
+	max_pathlen = env_int("RAWHIDE_TEST_PATHLEN_MAX", 1, max_pathlen, max_pathlen);
+
+	/* Initialize state */
+
+	attr.fpath = malloc_or_fatalsys(max_pathlen + 1);
+
+	attr.search_path = fpath;
+	attr.search_path_len = strlen(fpath);
+	attr.fpath_size = max_pathlen + 1;
+	attr.depth = 0;
+	attr.prune = 0;
+	attr.exit = 0;
+
+	attr.fs_dev = (dev_t)0;
+	attr.dirent_type = 0;
+	attr.dirent_ino = 0;
+
+	if ((len = strlcpy(attr.fpath, fpath, attr.fpath_size)) >= attr.fpath_size)
+	{
+		error("path is too long: %s", ok(fpath));
+		free(attr.fpath);
+
+		return -1;
+	}
+
+	/* Search (with prefetch threads running ahead, if requested, for sequential depth-first searches) */
+
+	if (attr.prefetch && attr.parallel == 1 && attr.path_threads == 1 && !attr.breadth_first)
+		prefetch_start();
+
+	rc = (attr.parallel > 1) ? par_search(len) : (attr.breadth_first) ? bfs_search(len) : rawhide_traverse(len, AT_FDCWD, NULL);
+
+	if (prefetch_cwd_fd != -1)
+		prefetch_stop();
+
+	if (checkpoint_fname)
+		checkpoint_path_done();
+
+	/* Cleanup */
+
+	free(attr.fpath);
+	runtime_buffers_free();
+
+	return rc;
+}
+
+/*
+
+static void index_flush(llong depth, llong base_depth, ipending_t *pending, size_t *npending);
+
+For rawhide_search_index() with -D: Test the pending directories (whose
+entries have all been tested) at the given depth or deeper.
+
+*/
+
+typedef struct ipending_t ipending_t;
+struct ipending_t
+{
+	irec_t *rec;            /* The directory's record */
+	size_t nul_posi;        /* The length of its path */
+};
+
+static void index_flush(llong depth, llong base_depth, ipending_t *pending, size_t *npending)
+{
+	irec_t *rec;
+
+	while (*npending && (rec = pending[*npending - 1].rec)->depth >= depth)
+	{
+		attr.fpath[pending[--*npending].nul_posi] = '\0';
+		attr.depth = rec->depth - base_depth;
+		*attr.statbuf = *rec->statbuf;
+		attr.stat_done = NEED_STAT;
+		attr.followed = (int)rec->followed;
+		#ifdef IFTODT
+		attr.dirent_type = IFTODT(rec->statbuf->st_mode);
+		#endif
+		attr.dirent_ino = rec->statbuf->st_ino;
+		rawhide_evaluate(AT_FDCWD, NULL);
+		attr.prune = 0;
+	}
+}
+
+/*
+
+int rawhide_search_index(char *fname, char **paths, int npaths);
+
+Search for entries in an index (written by -Z) that satisfy the search
+criteria (for the -z option), rather than in the filesystem. The paths
+parameter contains npaths search paths. Each one must be an entry in the
+index (a search path, or an entry within one). If there are none, all of
+the index's search paths are searched. Returns -1 if any of the search
+paths aren't in the index, otherwise 0.
+
+*/
+
+int rawhide_search_index(char *fname, char **paths, int npaths)
+{
+	char *index, *slash_posp, *found;
+	size_t index_size = 0, pos, len, *nul_posi = NULL, nul_posi_size = 0, start;
+	ipending_t *pending = NULL;
+	size_t npending = 0, pending_size = 0;
+	llong d, base_depth = -1, skip_depth = -1;
+	irec_t *rec;
+	int i, match, rc = 0;
+
+	debug(("rawhide_search_index(fname=%s)", fname));
+
+	if (!(index = index_map(fname, &index_size, -1)))
+		fatal("%s: Not an index", ok(fname));
+
+	/* Remove any trailing slashes from the search paths */
+
+	for (i = 0; i < npaths; ++i)
+		while ((slash_posp = strrchr(paths[i], '/')) && !slash_posp[1] && slash_posp > paths[i])
+			*slash_posp = '\0';
+
+	found = malloc_or_fatalsys(npaths + 1);
+	memset(found, 0, npaths + 1);
+
+	/* Initialize state */
+
+	attr.fpath_size = 1024;
+	attr.fpath = malloc_or_fatalsys(attr.fpath_size);
+	attr.prune = 0;
+	attr.exit = 0;
+	attr.fs_dev = (dev_t)0;
+	attr.dirent_type = 0;
+	attr.dirent_ino = 0;
+
+	/* Search the entries in the index in order, rebuilding their paths */
+
+	for (pos = sizeof(ihdr_t); pos < index_size; pos += IREC_SIZE(rec->len))
+	{
+		rec = index_rec(index, index_size, pos, fname);
+		d = rec->depth;
+
+		/* Skip the contents of directories that aren't being searched */
+
+		if (skip_depth != -1 && d > skip_depth)
+			continue;
+
+		skip_depth = -1;
+
+		if (d && (size_t)d > nul_posi_size)
+			fatal("%s: Corrupt index", ok(fname));
+
+		/* Finish with the directories that this entry isn't inside (for -D) */
+
+		if (attr.depth_first)
+			index_flush(d, base_depth, pending, &npending);
+
+		if (base_depth != -1 && d <= base_depth)
+			base_depth = -1;
+
+		/* Build the path */
+
+		start = (d) ? nul_posi[d - 1] : 0;
+
+		if (start + 1 + rec->len + 1 > attr.fpath_size)
+			attr.fpath = realloc_or_fatalsys(attr.fpath, attr.fpath_size = (start + 1 + rec->len + 1) * 2);
+
+		if (d && attr.fpath[start - 1] != '/')
+			attr.fpath[start++] = '/';
+
+		memcpy(attr.fpath + start, rec->name, rec->len + 1);
+
+		if ((size_t)d == nul_posi_size)
+			nul_posi = realloc_or_fatalsys(nul_posi, (nul_posi_size = (nul_posi_size) ? nul_posi_size * 2 : 64) * sizeof(size_t));
+
+		nul_posi[d] = start + rec->len;
+
+		/* Outside the search paths, only look inside directories that contain one */
+
+		if (base_depth == -1)
+		{
+			for (match = (npaths) ? -1 : 0, i = 0; i < npaths; ++i)
+				if (!strcmp(paths[i], attr.fpath))
+					match = i;
+
+			if (match == -1)
+			{
+				len = nul_posi[d];
+
+				for (i = 0; i < npaths; ++i)
+					if (!strncmp(paths[i], attr.fpath, len) && (paths[i][len] == '/' || attr.fpath[len - 1] == '/'))
+						break;
+
+				if (!isdir(rec->statbuf) || i == npaths)
+					skip_depth = d;
+
+				continue;
+			}
+
+			found[match] = 1;
+			base_depth = d;
+			attr.search_path = (npaths) ? paths[match] : rec->name;
+			attr.search_path_len = strlen(attr.search_path);
+			attr.fs_dev = rec->statbuf->st_dev;
+		}
+
+		/* Test this entry */
+
+		attr.depth = d - base_depth;
+		*attr.statbuf = *rec->statbuf;
+		attr.stat_done = NEED_STAT;
+		attr.followed = (int)rec->followed;
+		#ifdef IFTODT
+		attr.dirent_type = IFTODT(rec->statbuf->st_mode);
+		#endif
+		attr.dirent_ino = rec->statbuf->st_ino;
+
+		if (!attr.depth_first)
+		{
+			rawhide_evaluate(AT_FDCWD, NULL);
+
+			if (!rawhide_descending())
+				skip_depth = d;
+
+			attr.prune = 0;
+		}
+		else if (rawhide_descending())
+		{
+			if (npending == pending_size)
+				pending = realloc_or_fatalsys(pending, (pending_size = (pending_size) ? pending_size * 2 : 64) * sizeof(ipending_t));
+
+			pending[npending].rec = rec;
+			pending[npending++].nul_posi = nul_posi[d];
+		}
+		else
+		{
+			rawhide_evaluate(AT_FDCWD, NULL);
+			skip_depth = d;
+		}
+	}
+
+	if (attr.depth_first)
+		index_flush(0, base_depth, pending, &npending);
+
+	/* Report any search paths that aren't in the index */
+
+	for (i = 0; i < npaths; ++i)
+		if (!found[i])
+			rc = error("%s: Not in the index", ok(paths[i]));
+
+	/* Cleanup */
+
+	free(found);
+	free(pending);
+	free(nul_posi);
+	free(attr.fpath);
+	attr.fpath = NULL;
+	munmap(index, index_size);
+	runtime_buffers_free();
+
+	return rc;
+}
+
+/*
+
+Path lists (-@)
+
+With the -@ option, the search criteria are applied to a list of paths
+(e.g., from git ls-files -z, a database export, or an earlier rh -0) that
+is read from a file (or stdin), instead of to the entries found by
+searching directories. Each path is tested as if it were a search path,
+but directories aren't searched. If the list contains any nul bytes, they
+separate the paths. Otherwise, newlines do.
+
+Each path is statted relative to its parent directory, and consecutive
+paths with the same parent share one open file descriptor for it (so
+that each lookup is a single step). With -O, the list is sorted by parent
+directory first (keeping the list order within each directory), so that
+each directory is only opened once. With io_uring on Linux
+(RAWHIDE_IO_URING), the paths in each directory are statted in batches
+(see batch_stat()).
+
+*/
+
+typedef struct lentry_t lentry_t;
+struct lentry_t
+{
+	char *path;             /* The path (without any trailing slashes) */
+	size_t dirlen;          /* The length of its parent directory's path (with the slash), or 0 */
+	size_t seq;             /* Its position in the list */
+};
+
+#define LIST_BATCH_SIZE 1024 /* Maximum number of paths to stat at once */
+
+/*
+
+static char *list_read(const char *fname, size_t *len);
+
+Return the contents of the list of paths, fname ("-" for stdin), and its
+length (for -@). It's a fatal error if it can't be read.
+
+*/
+
+static char *list_read(const char *fname, size_t *len)
+{
+	size_t size = 65536;
+	ssize_t bytes;
+	char *list;
+	int fd;
+
+	if (!strcmp(fname, "-"))
+		fd = STDIN_FILENO, fname = "stdin";
+	else if ((fd = open(fname, O_RDONLY)) == -1)
+		fatalsys("%s", ok(fname));
+
+	list = malloc_or_fatalsys(size);
+
+	for (*len = 0; (bytes = read(fd, list + *len, size - *len - 1)) != 0; )
+	{
+		if (bytes == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fatalsys("read %s", ok(fname));
+		}
+
+		if ((*len += bytes) == size - 1)
+			list = realloc_or_fatalsys(list, size *= 2);
+	}
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	list[*len] = '\0';
+
+	return list;
+}
 
 /*
 
-llong env_int(char *envname, llong min_value, llong max_value, llong default);
+static int list_cmp(const void *a, const void *b);
 
-Get an integer from an environment variable. Check that it is within
-required limits. Ignore invalid values.
+Compare list entries by parent directory, and then by their position in
+the list (for qsort() with -@ and -O).
 
 */
 
-llong env_int(char *envname, llong min_value, llong max_value, llong default_value)
+static int list_cmp(const void *a, const void *b)
 {
-	char *env, *endptr = NULL;
-	llong e;
+	const lentry_t *ea = a, *eb = b;
+	int cmp;
 
-	if ((env = getenv(envname)) && *env)
-	{
-		errno = 0;
-		e = strtoll(env, &endptr, 10);
+	if ((cmp = memcmp(ea->path, eb->path, (ea->dirlen < eb->dirlen) ? ea->dirlen : eb->dirlen)))
+		return cmp;
 
-		if ((endptr && !*endptr) && errno != ERANGE)
-			if ((min_value == -1 || e >= min_value) && (max_value == -1 || e <= max_value))
-				return e;
-	}
+	if (ea->dirlen != eb->dirlen)
+		return (ea->dirlen < eb->dirlen) ? -1 : 1;
 
-	return default_value;
+	return (ea->seq < eb->seq) ? -1 : (ea->seq > eb->seq) ? 1 : 0;
 }
 
 /*
 
-int rawhide_search(char *fpath);
+int rawhide_search_list(char *fname);
 
-Search for filesystem entries that satisfy the search criteria.
-Initialize global attr runtime state, then call rawhide_traverse().
-The fpath parameter is the search path.
+Test the paths listed in the file fname ("-" for stdin) against the search
+criteria (for the -@ option), without searching any directories. Returns
+-1 if any of them couldn't be tested, otherwise 0.
 
 */
 
-int rawhide_search(char *fpath)
+int rawhide_search_list(char *fname)
 {
+	char *list, *end, *s, *next, *slash_posp, *dirpath, *basename;
+	size_t list_len, n = 0, size = 0, i, j, k, len;
+	lentry_t *entries = NULL;
 	llong max_pathlen;
-	char *slash_posp;
-	int rc = 0;
-	size_t len;
+	rhbatch_t *batch;
+	rhdirent_t entry[1];
+	int sep, cwd_fd, dir_fd, rc = 0;
 
-	debug(("rawhide_search(fpath=%s)", fpath));
+	debug(("rawhide_search_list(fname=%s)", fname));
 
-	/* Remove any trailing slashes */
+	list = list_read(fname, &list_len);
+	sep = (memchr(list, '\0', list_len)) ? '\0' : '\n';
 
-	while ((slash_posp = strrchr(fpath, '/')) && !slash_posp[1] && slash_posp > fpath)
-		*slash_posp = '\0';
+	/* Split the list into paths (without any trailing slashes, and skipping empty ones) */
 
-	/* Determine the maximum path length on this filesystem */
+	for (s = list, end = list + list_len; s < end; s = next)
+	{
+		if ((next = memchr(s, sep, end - s)))
+			*next++ = '\0';
+		else
+			next = end;
 
-	max_pathlen = pathconf(fpath, _PC_PATH_MAX);
-	max_pathlen = (max_pathlen == -1) ? 1024 : max_pathlen + 2;
-	max_pathlen = env_int("RAWHIDE_TEST_PATHLEN_MAX", 1, max_pathlen, max_pathlen);
+		if (!(len = strlen(s)))
+			continue;
+
+		while (len > 1 && s[len - 1] == '/')
+			s[--len] = '\0';
+
+		if (n == size)
+			entries = realloc_or_fatalsys(entries, (size = (size) ? size * 2 : 1024) * sizeof(lentry_t));
+
+		entries[n].path = s;
+		entries[n].dirlen = ((slash_posp = strrchr(s, '/')) && slash_posp[1]) ? slash_posp - s + 1 : 0;
+		entries[n].seq = n;
+		++n;
+	}
+
+	/* Group the paths by parent directory (for -O) */
+
+	if (attr.inode_order)
+		qsort(entries, n, sizeof(lentry_t), list_cmp);
 
 	/* Initialize state */
 
-	attr.fpath = malloc_or_fatalsys(max_pathlen + 1);
+	max_pathlen = pathconf(".", _PC_PATH_MAX);
+	max_pathlen = (max_pathlen == -1) ? 1024 : max_pathlen + 2;
+	max_pathlen = env_int("RAWHIDE_TEST_PATHLEN_MAX", 1, max_pathlen, max_pathlen);
 
-	attr.search_path = fpath;
-	attr.search_path_len = strlen(fpath);
 	attr.fpath_size = max_pathlen + 1;
-	attr.depth = 0;
+	attr.fpath = malloc_or_fatalsys(attr.fpath_size);
+	dirpath = malloc_or_fatalsys(attr.fpath_size);
 	attr.prune = 0;
 	attr.exit = 0;
-
 	attr.fs_dev = (dev_t)0;
 
-	if ((len = strlcpy(attr.fpath, fpath, attr.fpath_size)) >= attr.fpath_size)
+	batch = malloc_or_fatalsys(sizeof(rhbatch_t));
+	memset(batch, 0, sizeof(rhbatch_t));
+	entry->ino = 0;
+	entry->type = 0;
+
+	/* Parent directories are opened relative to the initial cwd (shell commands change it) */
+
+	if ((cwd_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+		fatalsys("open .");
+
+	/* Test the paths, a batch of consecutive paths with the same parent directory at a time */
+
+	for (i = 0; i < n; i = j)
 	{
-		error("path is too long: %s", ok(fpath));
-		free(attr.fpath);
+		for (j = i + 1; j < n && j - i < LIST_BATCH_SIZE && entries[j].dirlen == entries[i].dirlen && !memcmp(entries[j].path, entries[i].path, entries[i].dirlen); ++j)
+			;
 
-		return -1;
-	}
+		/* Open the parent directory (or use the whole path relative to the initial cwd if it can't be) */
+
+		dir_fd = AT_FDCWD;
+		len = entries[i].dirlen - (entries[i].dirlen > 1); /* Keep the slash for the root directory */
+
+		if (entries[i].dirlen && len < attr.fpath_size)
+		{
+			memcpy(dirpath, entries[i].path, len);
+			dirpath[len] = '\0';
+
+			if ((dir_fd = openat(cwd_fd, dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+			{
+				debug(("openat %s failed: %s (using whole paths)", dirpath, strerror(errno)));
+				dir_fd = AT_FDCWD;
+			}
+		}
+
+		if (dir_fd == AT_FDCWD && fchdir(cwd_fd) == -1)
+			fatalsys("fchdir back");
+
+		/* Fetch the stat information for the whole batch at once (for io_uring or -OO) */
+
+		batch->n = 0;
+
+		if (attr.inode_order == 2 || attr.io_uring)
+		{
+			for (batch->names_len = 0, k = i; k < j; ++k)
+			{
+				entry->name = entries[k].path + ((dir_fd == AT_FDCWD) ? 0 : entries[k].dirlen);
+				batch_add(batch, entry);
+			}
+
+			batch->stat = realloc_or_fatalsys(batch->stat, batch->alloc * sizeof(batchstat_t));
+
+			for (k = 0; k < (size_t)batch->n; ++k)
+				batch->stat[k].done = 0;
+
+			batch_stat(dir_fd, batch);
+		}
+
+		/* Test each path (like a search path at depth 0) */
+
+		for (k = i; k < j; ++k)
+		{
+			if (strlcpy(attr.fpath, entries[k].path, attr.fpath_size) >= attr.fpath_size)
+			{
+				rc = error("path is too long: %s", ok(entries[k].path));
 
-	/* Search */
+				continue;
+			}
+
+			attr.search_path = entries[k].path;
+			attr.search_path_len = strlen(entries[k].path);
+			attr.depth = 0;
+			attr.dirent_type = 0;
+			attr.dirent_ino = 0;
+			basename = (dir_fd == AT_FDCWD) ? NULL : attr.fpath + entries[k].dirlen;
+			batch_fetched = (k - i < (size_t)batch->n && batch->stat[k - i].done) ? &batch->stat[k - i] : NULL;
+
+			if (rawhide_stat(dir_fd, basename) == -1)
+			{
+				rc = -1;
+
+				continue;
+			}
+
+			rawhide_evaluate(dir_fd, basename);
+			attr.prune = 0;
+		}
 
-	rc = rawhide_traverse(len, AT_FDCWD, NULL);
+		if (dir_fd != AT_FDCWD)
+			close(dir_fd);
+	}
 
 	/* Cleanup */
 
+	if (fchdir(cwd_fd) == -1)
+		fatalsys("fchdir back");
+
+	close(cwd_fd);
+	batch_free(batch);
+	free(dirpath);
+	free(entries);
+	free(list);
+	free(attr.fpath);
+	attr.fpath = NULL;
+	runtime_buffers_free();
+
+	return rc;
+}
+
+#ifdef HAVE_INOTIFY
+
+/*
+
+static void watch_remove(const char *path);
+
+Stop watching the directory with the given path, and any directories
+within it (because it was moved away).
+
+*/
+
+static void watch_remove(const char *path)
+{
+	size_t len = strlen(path);
+	int wd;
+
+	for (wd = 0; wd < watches_size; ++wd)
+		if (watches[wd] && !strncmp(watches[wd]->path, path, len) && (!watches[wd]->path[len] || watches[wd]->path[len] == '/'))
+			inotify_rm_watch(watch_fd, wd); /* The watch is freed by IN_IGNORED */
+}
+
+/*
+
+static int watch_superseded(struct inotify_event *event, char *pos, char *end);
+
+Return whether or not a change event for an entry is superseded by a later
+event for the same entry (between pos and end) in the same batch of events.
+For example, creating a file with touch(1) changes its attributes, and then
+closes it after writing, but it only needs to be tested once.
+
+*/
+
+static int watch_superseded(struct inotify_event *event, char *pos, char *end)
+{
+	struct inotify_event *later;
+
+	if (!(event->mask & (IN_CLOSE_WRITE | IN_ATTRIB)) || !event->len)
+		return 0;
+
+	for (; pos < end; pos += sizeof(struct inotify_event) + later->len)
+		if ((later = (struct inotify_event *)pos)->wd == event->wd && later->len && !strcmp(later->name, event->name))
+			return 1;
+
+	return 0;
+}
+
+/*
+
+static int watch_event(struct inotify_event *event);
+
+Respond to an inotify event: Search new entries (and new directories'
+contents), and test changed entries. On error, returns -1.
+
+*/
+
+static int watch_event(struct inotify_event *event)
+{
+	struct stat statbuf[1];
+	size_t nul_posi, basename_posi;
+	watch_t *w, *a;
+	int dir_fd, rc = 0;
+
+	if (event->mask & IN_Q_OVERFLOW)
+		return error("inotify event queue overflowed (some changes were missed)");
+
+	if (event->wd < 0 || event->wd >= watches_size || !(w = watches[event->wd]))
+		return 0;
+
+	/* The directory is no longer watched */
+
+	if (event->mask & IN_IGNORED)
+	{
+		debug(("unwatch %s (wd %d)", w->path, event->wd));
+		free(w->path);
+		free(w);
+		watches[event->wd] = NULL;
+		--watches_count;
+
+		return 0;
+	}
+
+	if (!event->len)
+		return 0;
+
+	/* Build the entry's path */
+
+	basename_posi = strlen(w->path);
+
+	if (basename_posi + 1 + strlen(event->name) + 1 > attr.fpath_size)
+		attr.fpath = realloc_or_fatalsys(attr.fpath, attr.fpath_size = (basename_posi + 1 + strlen(event->name) + 1) * 2);
+
+	strcpy(attr.fpath, w->path);
+
+	if (basename_posi && attr.fpath[basename_posi - 1] != '/')
+		attr.fpath[basename_posi++] = '/';
+
+	strcpy(attr.fpath + basename_posi, event->name);
+	nul_posi = basename_posi + strlen(event->name);
+
+	debug(("watch event 0x%x %s", event->mask, attr.fpath));
+
+	/* A directory that was moved away (or deleted) */
+
+	if (event->mask & (IN_MOVED_FROM | IN_DELETE))
+	{
+		if (event->mask & IN_ISDIR)
+			watch_remove(attr.fpath);
+
+		return 0;
+	}
+
+	/* Prepare the runtime state as though the entry were being searched */
+
+	attr.depth = w->depth + 1;
+	attr.search_path = w->search_path;
+	attr.search_path_len = strlen(w->search_path);
+	attr.fs_dev = w->fs_dev;
+	attr.prune = 0;
+	attr.dirent_type = 0;
+	attr.dirent_ino = 0;
+	watch_current = event->wd;
+
+	/* Put the directory and its ancestors on the search stack (to detect filesystem cycles) */
+
+	search_stack_grow(attr.depth);
+
+	for (a = w; a; a = (a->parent != -1 && watches[a->parent] && watches[a->parent]->depth == a->depth - 1) ? watches[a->parent] : NULL)
+	{
+		attr.search_stack[a->depth].dev = a->dev;
+		attr.search_stack[a->depth].ino = a->ino;
+	}
+
+	search_stack_rehash(attr.depth);
+
+	if ((dir_fd = openat(watch_cwd_fd, w->path, O_RDONLY)) == -1)
+		return errorsys("%s", ok(w->path));
+
+	fcntl_set_fdflag(dir_fd, FD_CLOEXEC);
+
+	/* It might not be there anymore */
+
+	if (fstatat(dir_fd, event->name, statbuf, AT_SYMLINK_NOFOLLOW) == -1)
+	{
+		close(dir_fd);
+
+		return 0;
+	}
+
+	if (event->mask & (IN_CREATE | IN_MOVED_TO))
+	{
+		/* A new file that was opened for writing is tested when it is closed */
+
+		if (!(event->mask & IN_CREATE) || !isreg(statbuf) || statbuf->st_nlink != 1)
+		{
+			levels_base = attr.depth;
+
+			if (rawhide_traverse(nul_posi, dir_fd, attr.fpath + basename_posi) == -1)
+				rc = -1;
+		}
+	}
+	else if (rawhide_stat(dir_fd, attr.fpath + basename_posi) != -1)
+	{
+		rawhide_evaluate(dir_fd, attr.fpath + basename_posi);
+		attr.prune = 0;
+	}
+	else
+		rc = -1;
+
+	close(dir_fd);
+	watch_current = -1;
+
+	return rc;
+}
+
+#endif
+
+/*
+
+int rawhide_watch(void);
+
+After searching (for the -w option), wait for changes in the directories
+that were searched, and search (or test) the entries that changed. Only
+returns when there are no more directories being watched (or on error).
+Returns -1 if any errors were encountered, otherwise 0.
+
+*/
+
+int rawhide_watch(void)
+{
+	#ifdef HAVE_INOTIFY
+	size_t buf_size = 64 * 1024;
+	char *buf = malloc_or_fatalsys(buf_size); /* Aligned for struct inotify_event */
+	struct inotify_event *event;
+	ssize_t bytes;
+	char *pos;
+	int rc = 0;
+
+	debug(("rawhide_watch(watches=%d)", watches_count));
+
+	attr.fpath_size = 1024;
+	attr.fpath = malloc_or_fatalsys(attr.fpath_size);
+	attr.exit = 0;
+
+	while (watches_count)
+	{
+		/* Output any matches before waiting */
+
+		fflush(stdout);
+
+		if ((bytes = read(watch_fd, buf, buf_size)) == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			rc = errorsys("inotify read");
+			break;
+		}
+
+		for (pos = buf; pos < buf + bytes; pos += sizeof(struct inotify_event) + event->len)
+		{
+			event = (struct inotify_event *)pos;
+
+			if (!watch_superseded(event, pos + sizeof(struct inotify_event) + event->len, buf + bytes) && watch_event(event) == -1)
+				rc = -1;
+		}
+	}
+
+	free(buf);
 	free(attr.fpath);
+	attr.fpath = NULL;
+	runtime_buffers_free();
+
+	return rc;
+	#else
+	return 0;
+	#endif
+}
+
+/*
+
+static void runtime_buffers_free(void);
+
+Deallocate this thread's long-lived on-demand buffers.
+
+*/
+
+static void runtime_buffers_free(void)
+{
+	getdents_buffers_free();
+
+	if (levels)
+	{
+		free(levels);
+		levels = NULL;
+		levels_size = 0;
+	}
+
+	#ifdef HAVE_IO_URING
+	uring_free();
+	#endif
 
 	#ifdef HAVE_PCRE2
 	pcre2_cache_free();
@@ -827,8 +6760,6 @@ int rawhide_search(char *fpath)
 	}
 
 	wcoffset(NULL);
-
-	return rc;
 }
 
 /*
@@ -1219,7 +7150,7 @@ permissions in symbolic ls -l format.
 const char *modestr(struct stat *statbuf)
 {
 	#define MODESIZE 11
-	static char modebuf[MODESIZE];
+	static THREAD_LOCAL char modebuf[MODESIZE];
 
 	static char *ug_perm[] =
 	{
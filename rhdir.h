@@ -25,9 +25,61 @@
 #ifndef RAWHIDE_RHDIR_H
 #define RAWHIDE_RHDIR_H
 
+/* Directory entry (name, inode number, and file type) */
+
+typedef struct rhdirent_t rhdirent_t;
+struct rhdirent_t
+{
+	char *name;             /* The entry's base name */
+	ino_t ino;              /* The entry's inode number */
+	int type;               /* The entry's file type (DT_*) or 0 (DT_UNKNOWN) if not known */
+};
+
+/* Batched statx(2) requests with io_uring need struct statx */
+
+#if defined(HAVE_IO_URING) && !HAVE_STATX_BTIME
+#undef HAVE_IO_URING
+#endif
+
+/* Directory stream (getdents64(2) on Linux, or readdir(3)) */
+
+typedef struct rhdir_t rhdir_t;
+struct rhdir_t
+{
+	int fd;                 /* The directory's file descriptor */
+	#ifdef HAVE_GETDENTS64
+	char *buf;              /* Buffer of entries from getdents64(2) */
+	size_t pos;             /* Offset of the next entry in buf */
+	size_t end;             /* Offset of the end of the entries in buf */
+	#else
+	DIR *dir;               /* Directory stream from fdopendir(3) */
+	#endif
+	struct rhbatch_t *batch; /* Batch of entries (-O or RAWHIDE_IO_URING) */
+	rhdirent_t entry[1];    /* The current entry */
+};
+
+typedef struct rhbatch_t rhbatch_t;
+
 llong env_int(char *envname, llong min_value, llong max_value, llong default_value);
 int rawhide_search(char *fpath);
+int rawhide_search_paths(char **paths, int npaths);
+void rawhide_index_open(char *fname, int snapshot);
+void rawhide_index_close(void);
+void rawhide_ignore_init(char *names);
+void rawhide_checkpoint_open(char *fname, int resume);
+void rawhide_checkpoint_close(void);
+int rawhide_search_index(char *fname, char **paths, int npaths);
+int rawhide_search_list(char *fname);
+void rawhide_watch_init(void);
+int rawhide_watch(void);
 int following_symlinks(void);
+const char *rawhide_fstype(dev_t dev);
+rhdir_t *rawhide_opendir(int dir_fd);
+rhdirent_t *rawhide_readdir(rhdir_t *dir);
+rhdirent_t *rawhide_readdir_batch(rhdir_t *dir);
+void rawhide_closedir(rhdir_t *dir);
+void rawhide_lock(void);
+void rawhide_unlock(void);
 const char *modestr(struct stat *statbuf);
 void visitf_default(void);
 void visitf_long(void);
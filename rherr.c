@@ -50,9 +50,11 @@ int error(const char *format, ...)
 	va_list args;
 
 	va_start(args, format);
+	flockfile(stderr); /* Don't interleave with other -P threads */
 	fprintf(stderr, "%s: ", prog_name);
 	vfprintf(stderr, format, args);
 	fprintf(stderr, "\n");
+	funlockfile(stderr);
 	va_end(args);
 
 	return -1;
@@ -75,9 +77,11 @@ int errorsys(const char *format, ...)
 	va_list args;
 
 	va_start(args, format);
+	flockfile(stderr); /* Don't interleave with other -P threads */
 	fprintf(stderr, "%s: ", prog_name);
 	vfprintf(stderr, format, args);
 	fprintf(stderr, ": %s\n", strerror(errno));
+	funlockfile(stderr);
 	va_end(args);
 
 	return -1;
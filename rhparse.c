@@ -43,6 +43,7 @@
 #include "rhdata.h"
 #include "rhcmds.h"
 #include "rhstr.h"
+#include "rherr.h"
 
 #ifdef NDEBUG
 #define debug(args)
@@ -68,6 +69,7 @@ static void parse_expression(void);
 static void parse_cond_expr(void);
 static void parse_or_expr(void);
 static void parse_and_expr(void);
+static void parse_chain(int op, void (*parse_operand)(void));
 static void parse_bitor_expr(void);
 static void parse_bitxor_expr(void);
 static void parse_bitand_expr(void);
@@ -499,11 +501,135 @@ static void parse_or_expr(void)
 
 	debug_extra(("or_expr()"));
 
-	parse_and_expr();
+	parse_chain(OR, parse_and_expr);
+}
+
+/*
+
+static void parse_and_expr(void);
+
+Parse an and expression:
+
+	<and> ::= <bitor> "&&" <and> | <bitor>
+
+*/
+
+static void parse_and_expr(void)
+{
+	/* (a && b) is ((a) ? (b) ? 1 : 0 : 0) */
+
+	debug_extra(("and_expr()"));
+
+	parse_chain(AND, parse_bitor_expr);
+}
+
+/*
+
+static void add_operand(instr_t *code, llong start, llong from, llong to);
+
+Store the instructions of an operand that was compiled from the given pc
+up to (but not including) the other given pc, and saved in code (which was
+compiled from start). Its jumps are moved along with it.
+
+*/
+
+static void add_operand(instr_t *code, llong start, llong from, llong to)
+{
+	llong delta = PC - from, pc;
+
+	for (pc = from; pc < to; ++pc)
+	{
+		instr_t *instr = &code[pc - start];
+
+		if (rawhide_instruction(instr->func, instr->value + ((instr->func == c_qm || instr->func == c_colon) ? delta : 0)) == -1)
+			parser_error("program too big");
+	}
+}
+
+/*
+
+static void parse_chain(int op, void (*parse_operand)(void));
+
+Parse a chain of operands (using the parse_operand function) separated by
+the && or || operators (op is AND or OR), and compile them.
+
+The operands are first compiled one after the other. Then, unless
+RAWHIDE_NO_OPTIMIZER is set, they are put in order of their estimated cost
+(see rawhide_cost()), so that cheap tests (e.g., file name patterns) can
+decide the result before any expensive tests (e.g., .what) are needed.
+Operands with side effects (e.g., prune or .sh), or that can report errors
+(e.g., .body), stay where they are, and nothing is moved past them, so the
+output, error messages, and exit status are unchanged. Then they are
+compiled again, with the operators.
+
+*/
+
+static void parse_chain(int op, void (*parse_operand)(void))
+{
+	llong start = PC, *from = NULL, *cost, i, j, n = 0, tmp;
+	int *effects, *order;
+	instr_t *code;
+
+	/* Parse the operands (without the operators for now) */
 
 	for (;;)
 	{
-		if (token == OR)
+		from = realloc_or_fatalsys(from, (n + 2) * sizeof(llong));
+		from[n++] = PC;
+		parse_operand();
+
+		if (token != op)
+			break;
+
+		token = get_token();
+	}
+
+	from[n] = PC;
+
+	if (n == 1)
+	{
+		free(from);
+
+		return;
+	}
+
+	/* Put them in order of cost */
+
+	cost = malloc_or_fatalsys(n * sizeof(llong));
+	effects = malloc_or_fatalsys(n * sizeof(int));
+	order = malloc_or_fatalsys(n * sizeof(int));
+
+	for (i = 0; i < n; ++i)
+	{
+		cost[i] = rawhide_cost(from[i], from[i + 1], &effects[i]);
+		order[i] = i;
+	}
+
+	for (i = 1; attr.optimize && i < n; ++i)
+	{
+		for (j = i; j > 0 && !effects[order[j]] && !effects[order[j - 1]] && cost[order[j]] < cost[order[j - 1]]; --j)
+		{
+			tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+	}
+
+	for (i = 0; i < n; ++i)
+		if (order[i] != i)
+			debug(("%s operand %d (cost %lld) moved to %d", (op == AND) ? "&&" : "||", order[i] + 1, cost[order[i]], (int)i + 1));
+
+	/* Compile them again in that order, with the operators */
+
+	code = malloc_or_fatalsys((PC - start) * sizeof(instr_t));
+	memcpy(code, &Program[start], (PC - start) * sizeof(instr_t));
+	PC = start;
+
+	add_operand(code, start, from[order[0]], from[order[0] + 1]);
+
+	for (i = 1; i < n; ++i)
+	{
+		if (op == OR)
 		{
 			int qm, colon;
 
@@ -514,8 +640,7 @@ static void parse_or_expr(void)
 			colon = PC;
 			add_instruction(c_colon, 0);
 
-			token = get_token();
-			parse_and_expr();
+			add_operand(code, start, from[order[i]], from[order[i] + 1]);
 
 			Program[qm].value = colon;
 			Program[colon].value = PC - 1;
@@ -532,39 +657,13 @@ static void parse_or_expr(void)
 			Program[colon].value = PC - 1;
 		}
 		else
-			break;
-	}
-}
-
-/*
-
-static void parse_and_expr(void);
-
-Parse an and expression:
-
-	<and> ::= <bitor> "&&" <and> | <bitor>
-
-*/
-
-static void parse_and_expr(void)
-{
-	/* (a && b) is ((a) ? (b) ? 1 : 0 : 0) */
-
-	debug_extra(("and_expr()"));
-
-	parse_bitor_expr();
-
-	for (;;)
-	{
-		if (token == AND)
 		{
 			int qm1, colon1;
 
 			qm1 = PC;
 			add_instruction(c_qm, 0);
 
-			token = get_token();
-			parse_bitor_expr();
+			add_operand(code, start, from[order[i]], from[order[i] + 1]);
 
 			{
 				int qm2, colon2;
@@ -591,9 +690,13 @@ static void parse_and_expr(void)
 			Program[qm1].value = colon1;
 			Program[colon1].value = PC - 1;
 		}
-		else
-			break;
 	}
+
+	free(from);
+	free(cost);
+	free(effects);
+	free(order);
+	free(code);
 }
 
 /*
@@ -297,7 +297,7 @@ static const char *sanitise(char *buf, size_t sz, const char *str)
 
 const char *ok(const char *str)
 {
-	static char buf[8192];
+	static THREAD_LOCAL char buf[8192];
 
 	return sanitise(buf, 8192, str);
 }
@@ -306,7 +306,7 @@ const char *ok(const char *str)
 
 const char *ok2(const char *str)
 {
-	static char buf[8192];
+	static THREAD_LOCAL char buf[8192];
 
 	return sanitise(buf, 8192, str);
 }
@@ -315,7 +315,7 @@ const char *ok2(const char *str)
 
 const char *oklen(const char *str, size_t len)
 {
-	static char buf[256];
+	static THREAD_LOCAL char buf[256];
 
 	if (!attr.ttyerr)
 		return strlcpy(buf, str, len + 1), buf;